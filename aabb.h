@@ -2,6 +2,14 @@
 #define AABB_H
 
 #include "rtweekend.h"
+#include "ray_packet.h"
+
+#include <cfloat>
+
+// Far slab distances are scaled up by 1 + 2*gamma(3), the bound on the relative rounding
+// error of (plane - origin) * inv_dir, so a ray that grazes a box is never reported as
+// missing it (Ize, "Robust BVH Ray Traversal").
+constexpr double slab_far_scale = 1.0 + 2.0 * (1.5 * DBL_EPSILON) / (1.0 - 1.5 * DBL_EPSILON);
 
 class aabb {
     public:
@@ -10,23 +18,84 @@ class aabb {
         point3 min() const { return minimum; }
         point3 max() const { return maximum; }
 
+        point3 centroid() const { return 0.5 * (minimum + maximum); }
+
+        // Grows the box in place to take in p or b; cheaper than surrounding_box() in loops.
+        void expand(const point3& p) {
+            for (int a = 0; a < 3; a++) {
+                minimum.e[a] = p.e[a] < minimum.e[a] ? p.e[a] : minimum.e[a];
+                maximum.e[a] = p.e[a] > maximum.e[a] ? p.e[a] : maximum.e[a];
+            }
+        }
+
+        void expand(const aabb& b) {
+            for (int a = 0; a < 3; a++) {
+                minimum.e[a] = b.minimum.e[a] < minimum.e[a] ? b.minimum.e[a] : minimum.e[a];
+                maximum.e[a] = b.maximum.e[a] > maximum.e[a] ? b.maximum.e[a] : maximum.e[a];
+            }
+        }
+
+        double surface_area() const {
+            auto d = maximum - minimum;
+            return 2.0 * (d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+        }
+
+        // The min (i = 0) or max (i = 1) corner, so traversal_ray::sign picks the near one.
+        const point3& corner(int i) const { return i ? maximum : minimum; }
+
         inline bool hit(const ray& r, double t_min, double t_max) const {
+            return hit(traversal_ray(r), t_min, t_max);
+        }
+
+        // Slab test using the ray's precomputed reciprocal direction and plane order, so it
+        // neither divides nor branches on the direction's sign. Where a slab distance is NaN
+        // (a ray in a slab plane), the "t0 > t_min ? t0 : t_min" form keeps the old bound.
+        inline bool hit(const traversal_ray& r, double t_min, double t_max) const {
             for (int a = 0; a < 3; a++) {
-                auto invD = 1.0f / r.direction()[a];
-                auto t0 = (min()[a] - r.origin()[a]) * invD;
-                auto t1 = (max()[a] - r.origin()[a]) * invD;
-                if (invD < 0.0f)
-                    std::swap(t0, t1);
+                auto t0 = (corner(r.sign[a])[a] - r.origin[a]) * r.inv_dir[a];
+                auto t1 = (corner(1 - r.sign[a])[a] - r.origin[a]) * r.inv_dir[a] * slab_far_scale;
                 t_min = t0 > t_min ? t0 : t_min;
                 t_max = t1 < t_max ? t1 : t_max;
-                if (t_max <= t_min)
-                    return false;
             }
-            return true;
+            return t_min < t_max;
+        }
+
+        // The same slab test for every active lane of a packet at once, using the
+        // packet's precomputed inverse directions. Returns the lanes that hit the box.
+        inline uint32_t hit_packet(const ray_packet& rays, uint32_t active, double t_min, const double* t_max) const {
+            uint32_t hits = 0;
+            const vdouble zero(0.0);
+            for (int c = 0; c < rays.size; c += vdouble::width) {
+                if (((active >> c) & ((1u << vdouble::width) - 1)) == 0)
+                    continue;
+
+                vdouble lo(t_min);
+                vdouble hi = vdouble::load(t_max + c);
+                slab(minimum.x(), maximum.x(), rays.ox + c, rays.inv_dx + c, zero, lo, hi);
+                slab(minimum.y(), maximum.y(), rays.oy + c, rays.inv_dy + c, zero, lo, hi);
+                slab(minimum.z(), maximum.z(), rays.oz + c, rays.inv_dz + c, zero, lo, hi);
+
+                hits |= static_cast<uint32_t>((lo < hi).bits()) << c;
+            }
+            return hits & active;
         }
 
         point3 minimum;
         point3 maximum;
+
+    private:
+        // Narrows [lo,hi) to the part of each ray inside one pair of slab planes. The
+        // ::max/::min operand order keeps lo and hi unchanged where a t is NaN.
+        static void slab(double low, double high, const double* origin, const double* inv_d,
+                         vdouble zero, vdouble& lo, vdouble& hi) {
+            auto o = vdouble::load(origin);
+            auto inv = vdouble::load(inv_d);
+            auto t0 = (vdouble(low) - o) * inv;
+            auto t1 = (vdouble(high) - o) * inv;
+            auto negative = inv < zero;
+            lo = ::max(select(negative, t1, t0), lo);
+            hi = ::min(select(negative, t0, t1) * vdouble(slab_far_scale), hi);
+        }
 };
 
 
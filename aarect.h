@@ -9,11 +9,16 @@ class xy_rect : public hittable {
         xy_rect() {}
 
         xy_rect(double _x0, double _x1, double _y0, double _y1, double _k, 
-            shared_ptr<material> mat)
+            const material* mat)
             : x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat) {};
 
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+            double t, x, y;
+            return intersect(r, t_min, t_max, t, x, y);
+        }
+
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
             // The bounding box must have non-zero width in each dimension, so pad the Z
             // dimension a small amount.
@@ -21,9 +26,31 @@ class xy_rect : public hittable {
             return true;
         }
 
+        virtual double pdf_value(const point3& origin, const vec3& v) const override {
+            double t, x, y;
+            if (!intersect(ray(origin, v), 0.001, infinity, t, x, y))
+                return 0;
+
+            auto area = (x1-x0)*(y1-y0);
+            auto distance_squared = t * t * v.length_squared();
+            auto cosine = fabs(v.z() / v.length());
+
+            return distance_squared / (cosine * area);
+        }
+
+        virtual vec3 random(const point3& origin, sampler& rng) const override {
+            auto random_point = point3(rng.random_double(x0,x1), rng.random_double(y0,y1), k);
+            return random_point - origin;
+        }
+
     public:
-        shared_ptr<material> mp;
+        const material* mp;
         double x0, x1, y0, y1, k;
+
+    private:
+        // The plane test shared by hit(), occluded() and pdf_value(): where r crosses the
+        // rect, if it does between t_min and t_max.
+        bool intersect(const ray& r, double t_min, double t_max, double& t, double& x, double& y) const;
 };
 
 class xz_rect : public hittable {
@@ -31,11 +58,16 @@ class xz_rect : public hittable {
         xz_rect() {}
 
         xz_rect(double _x0, double _x1, double _z0, double _z1, double _k,
-            shared_ptr<material> mat)
+            const material* mat)
             : x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
 
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+            double t, x, z;
+            return intersect(r, t_min, t_max, t, x, z);
+        }
+
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
             // The bounding box must have non-zero width in each dimension, so pad the Y
             // dimension a small amount.
@@ -44,25 +76,30 @@ class xz_rect : public hittable {
         }
 
         virtual double pdf_value(const point3& origin, const vec3& v) const override {
-            hit_record rec;
-            if (!this->hit(ray(origin, v), 0.001, infinity, rec))
+            double t, x, z;
+            if (!intersect(ray(origin, v), 0.001, infinity, t, x, z))
                 return 0;
 
             auto area = (x1-x0)*(z1-z0);
-            auto distance_squared = rec.t * rec.t * v.length_squared();
-            auto cosine = fabs(dot(v, rec.normal) / v.length());
+            auto distance_squared = t * t * v.length_squared();
+            auto cosine = fabs(v.y() / v.length());
 
             return distance_squared / (cosine * area);
         }
 
-        virtual vec3 random(const point3& origin) const override {
-            auto random_point = point3(random_double(x0,x1), k, random_double(z0,z1));
+        virtual vec3 random(const point3& origin, sampler& rng) const override {
+            auto random_point = point3(rng.random_double(x0,x1), k, rng.random_double(z0,z1));
             return random_point - origin;
         }
 
     public:
-        shared_ptr<material> mp;
+        const material* mp;
         double x0, x1, z0, z1, k;
+
+    private:
+        // The plane test shared by hit(), occluded() and pdf_value(): where r crosses the
+        // rect, if it does between t_min and t_max.
+        bool intersect(const ray& r, double t_min, double t_max, double& t, double& x, double& z) const;
 };
 
 class yz_rect : public hittable {
@@ -70,11 +107,16 @@ class yz_rect : public hittable {
         yz_rect() {}
 
         yz_rect(double _y0, double _y1, double _z0, double _z1, double _k,
-            shared_ptr<material> mat)
+            const material* mat)
             : y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
 
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+            double t, y, z;
+            return intersect(r, t_min, t_max, t, y, z);
+        }
+
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
             // The bounding box must have non-zero width in each dimension, so pad the X
             // dimension a small amount.
@@ -82,18 +124,45 @@ class yz_rect : public hittable {
             return true;
         }
 
+        virtual double pdf_value(const point3& origin, const vec3& v) const override {
+            double t, y, z;
+            if (!intersect(ray(origin, v), 0.001, infinity, t, y, z))
+                return 0;
+
+            auto area = (y1-y0)*(z1-z0);
+            auto distance_squared = t * t * v.length_squared();
+            auto cosine = fabs(v.x() / v.length());
+
+            return distance_squared / (cosine * area);
+        }
+
+        virtual vec3 random(const point3& origin, sampler& rng) const override {
+            auto random_point = point3(k, rng.random_double(y0,y1), rng.random_double(z0,z1));
+            return random_point - origin;
+        }
+
     public:
-        shared_ptr<material> mp;
+        const material* mp;
         double y0, y1, z0, z1, k;
+
+    private:
+        // The plane test shared by hit(), occluded() and pdf_value(): where r crosses the
+        // rect, if it does between t_min and t_max.
+        bool intersect(const ray& r, double t_min, double t_max, double& t, double& y, double& z) const;
 };
 
-bool xy_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    auto t = (k-r.origin().z()) / r.direction().z();
+bool xy_rect::intersect(const ray& r, double t_min, double t_max, double& t, double& x, double& y) const {
+    t = (k-r.origin().z()) / r.direction().z();
     if (t < t_min || t > t_max)
         return false;
-    auto x = r.origin().x() + t*r.direction().x();
-    auto y = r.origin().y() + t*r.direction().y();
-    if (x < x0 || x > x1 || y < y0 || y > y1)
+    x = r.origin().x() + t*r.direction().x();
+    y = r.origin().y() + t*r.direction().y();
+    return !(x < x0 || x > x1 || y < y0 || y > y1);
+}
+
+bool xy_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    double t, x, y;
+    if (!intersect(r, t_min, t_max, t, x, y))
         return false;
     rec.u = (x-x0)/(x1-x0);
     rec.v = (y-y0)/(y1-y0);
@@ -105,13 +174,18 @@ bool xy_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
     return true;
 }
 
-bool xz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    auto t = (k-r.origin().y()) / r.direction().y();
+bool xz_rect::intersect(const ray& r, double t_min, double t_max, double& t, double& x, double& z) const {
+    t = (k-r.origin().y()) / r.direction().y();
     if (t < t_min || t > t_max)
         return false;
-    auto x = r.origin().x() + t*r.direction().x();
-    auto z = r.origin().z() + t*r.direction().z();
-    if (x < x0 || x > x1 || z < z0 || z > z1)
+    x = r.origin().x() + t*r.direction().x();
+    z = r.origin().z() + t*r.direction().z();
+    return !(x < x0 || x > x1 || z < z0 || z > z1);
+}
+
+bool xz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    double t, x, z;
+    if (!intersect(r, t_min, t_max, t, x, z))
         return false;
     rec.u = (x-x0)/(x1-x0);
     rec.v = (z-z0)/(z1-z0);
@@ -123,13 +197,18 @@ bool xz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
     return true;
 }
 
-bool yz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    auto t = (k-r.origin().x()) / r.direction().x();
+bool yz_rect::intersect(const ray& r, double t_min, double t_max, double& t, double& y, double& z) const {
+    t = (k-r.origin().x()) / r.direction().x();
     if (t < t_min || t > t_max)
         return false;
-    auto y = r.origin().y() + t*r.direction().y();
-    auto z = r.origin().z() + t*r.direction().z();
-    if (y < y0 || y > y1 || z < z0 || z > z1)
+    y = r.origin().y() + t*r.direction().y();
+    z = r.origin().z() + t*r.direction().z();
+    return !(y < y0 || y > y1 || z < z0 || z > z1);
+}
+
+bool yz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    double t, y, z;
+    if (!intersect(r, t_min, t_max, t, y, z))
         return false;
     rec.u = (y-y0)/(y1-y0);
     rec.v = (z-z0)/(z1-z0);
@@ -0,0 +1,88 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include "rtweekend.h"
+#include "color.h"
+#include "film.h"
+
+#include <algorithm>
+
+// Controls for adaptive sampling. With adaptive sampling off every pixel takes exactly
+// samples_per_pixel samples; with it on a pixel takes between min_spp and max_spp samples
+// and stops as soon as its estimate is within the error threshold.
+struct adaptive_settings {
+    bool enabled = false;
+    double threshold = 0.05;    // target relative standard error of the pixel mean
+    int min_spp = 32;
+    int max_spp = 4096;
+    int batch_size = 16;        // samples taken between convergence checks
+};
+
+// Running estimate of one pixel. The radiance sum feeds the image, while the mean and
+// variance of its luminance (tracked with Welford's algorithm) decide convergence.
+class pixel_estimator {
+    public:
+        pixel_estimator() : n(0), mean(0), m2(0) {}
+
+        // Resumes from a previously saved estimate (see film).
+        pixel_estimator(const color& sum, int count, double sum_sq_dev)
+            : n(count), radiance(sum), mean(count > 0 ? luminance(sum) / count : 0), m2(sum_sq_dev) {}
+
+        void add(const color& sample) {
+            n++;
+            radiance += sample;
+
+            auto y = luminance(sample);
+            auto delta = y - mean;
+            mean += delta / n;
+            m2 += delta * (y - mean);
+        }
+
+        int count() const { return n; }
+        color sum() const { return radiance; }
+        double sum_sq_dev() const { return m2; }
+
+        double variance() const {
+            return n > 1 ? m2 / (n - 1) : 0.0;
+        }
+
+        // True once the standard error of the mean is below threshold relative to the mean.
+        // The mean is floored so that dark pixels, whose relative error is dominated by a
+        // handful of stray bright samples, do not soak up the whole budget.
+        bool converged(double threshold) const {
+            if (n < 2) return false;
+            auto std_error = sqrt(variance() / n);
+            return std_error <= threshold * std::max(mean, 0.05);
+        }
+
+    private:
+        int n;
+        color radiance;
+        double mean;
+        double m2;
+};
+
+// Number of samples still wanted for a pixel after a batch. Zero means the pixel is done.
+inline int samples_wanted(const pixel_estimator& est, const adaptive_settings& settings, int samples_per_pixel) {
+    if (!settings.enabled)
+        return samples_per_pixel - est.count();
+
+    if (est.count() >= settings.max_spp)
+        return 0;
+    if (est.count() >= settings.min_spp && est.converged(settings.threshold))
+        return 0;
+
+    auto batch = est.count() < settings.min_spp ? settings.min_spp - est.count() : settings.batch_size;
+    return std::min(batch, settings.max_spp - est.count());
+}
+
+// Writes the film's per-pixel sample counts as a top-down 8-bit grayscale map, scaled so
+// max_spp is white.
+inline void write_sample_map(uint8_t* buffer, const film& image, int max_spp) {
+    int index = 0;
+    for (int j = image.y0 + image.height-1; j >= image.y0; j--)
+        for (int i = image.x0; i < image.x0 + image.width; i++)
+            buffer[index++] = static_cast<uint8_t>(255.0 * clamp(double(image.count(i, j)) / max_spp, 0.0, 1.0));
+}
+
+#endif
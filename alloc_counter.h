@@ -0,0 +1,90 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Counts heap allocations made by the calling thread, so the render loop can check that it
+// does not allocate once it has warmed up. The counting operator new and delete
+// replacements are compiled into the one translation unit that defines
+// ALLOC_COUNTER_IMPLEMENTATION before including this header, the same way stb does it.
+
+uint64_t& thread_allocation_count();
+
+inline uint64_t allocation_count() {
+    return thread_allocation_count();
+}
+
+#endif
+
+// Outside the include guard so the implementation is emitted even when another header
+// included this one first.
+#if defined(ALLOC_COUNTER_IMPLEMENTATION) && !defined(ALLOC_COUNTER_IMPLEMENTED)
+#define ALLOC_COUNTER_IMPLEMENTED
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+uint64_t& thread_allocation_count() {
+    static thread_local uint64_t count = 0;
+    return count;
+}
+
+// Every operator new and delete below goes through these two, kept out of line, so the
+// compiler never sees a free() paired with an allocation it knows came from operator new
+// (-Wmismatched-new-delete).
+#if defined(__GNUC__)
+#define ALLOC_COUNTER_NOINLINE __attribute__((noinline))
+#else
+#define ALLOC_COUNTER_NOINLINE
+#endif
+
+ALLOC_COUNTER_NOINLINE void* counted_allocate(std::size_t size, std::size_t alignment) {
+    thread_allocation_count()++;
+    if (alignment <= alignof(std::max_align_t))
+        return std::malloc(size ? size : 1);
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+ALLOC_COUNTER_NOINLINE void counted_release(void* p) {
+    std::free(p);
+}
+
+void* operator new(std::size_t size) {
+    if (void* p = counted_allocate(size, 0))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return counted_allocate(size, 0);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept {
+    return operator new(size, tag);
+}
+
+void* operator new(std::size_t size, std::align_val_t align) {
+    if (void* p = counted_allocate(size, static_cast<std::size_t>(align)))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t align) {
+    return operator new(size, align);
+}
+
+void operator delete(void* p) noexcept { counted_release(p); }
+void operator delete[](void* p) noexcept { counted_release(p); }
+void operator delete(void* p, std::size_t) noexcept { counted_release(p); }
+void operator delete[](void* p, std::size_t) noexcept { counted_release(p); }
+void operator delete(void* p, std::align_val_t) noexcept { counted_release(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { counted_release(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { counted_release(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { counted_release(p); }
+
+#endif
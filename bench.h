@@ -0,0 +1,173 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "scene.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+// Ray casting throughput of a scene's acceleration structures, independent of shading.
+// Three ray sets are traced on one thread:
+//
+//     primary     one camera ray through every pixel
+//     secondary   a diffuse bounce from every primary hit, which is far less coherent
+//     occluded    the secondary rays again as any-hit queries, the way shadow rays are cast
+//
+// The rays are generated up front so only world.hit() or world.occluded() is timed. Each
+// set is traced several times and the best pass is reported, which keeps the numbers
+// comparable on a busy machine.
+//
+// A microbenchmark of the box test alone follows: every primary ray against a set of boxes
+// inside the scene's bounds, once with aabb::hit on a traversal_ray and once with the
+// divide-per-box slab test BVH traversal used to do.
+struct ray_benchmark_result {
+    const char* name;
+    size_t rays;
+    size_t hits;
+    double seconds;
+
+    double mrays_per_second() const { return rays / seconds * 1e-6; }
+};
+
+inline ray_benchmark_result time_rays(const char* name, const hittable& world,
+                                      const std::vector<ray>& rays, int passes,
+                                      bool any_hit = false) {
+    ray_benchmark_result result{name, rays.size(), 0, infinity};
+    hit_record rec;
+    for (int pass = 0; pass < passes; pass++) {
+        size_t hits = 0;
+        auto start = std::chrono::steady_clock::now();
+        if (any_hit) {
+            for (const auto& r : rays)
+                hits += world.occluded(r, 0.001, infinity);
+        } else {
+            for (const auto& r : rays)
+                hits += world.hit(r, 0.001, infinity, rec);
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        result.hits = hits;
+        result.seconds = std::min(result.seconds, elapsed.count());
+    }
+    return result;
+}
+
+// Both box tests are kept out of line, so each box is one call the way it is during BVH
+// traversal and the compiler can't hoist the divisions out of the benchmark's box loop.
+#if defined(__GNUC__)
+#define BENCH_NOINLINE __attribute__((noinline))
+#else
+#define BENCH_NOINLINE
+#endif
+
+// The slab test as it was before traversal_ray: a reciprocal per axis per box, and a branch
+// on its sign. Kept only as the baseline for the microbenchmark.
+BENCH_NOINLINE inline bool slab_test_dividing(const aabb& box, const ray& r, double t_min, double t_max) {
+    for (int a = 0; a < 3; a++) {
+        auto invD = 1.0f / r.direction()[a];
+        auto t0 = (box.min()[a] - r.origin()[a]) * invD;
+        auto t1 = (box.max()[a] - r.origin()[a]) * invD;
+        if (invD < 0.0f)
+            std::swap(t0, t1);
+        t_min = t0 > t_min ? t0 : t_min;
+        t_max = t1 < t_max ? t1 : t_max;
+        if (t_max <= t_min)
+            return false;
+    }
+    return true;
+}
+
+BENCH_NOINLINE inline bool slab_test_precomputed(const aabb& box, const traversal_ray& r,
+                                                 double t_min, double t_max) {
+    return box.hit(r, t_min, t_max);
+}
+
+// Times tests of every ray against every box, best of passes.
+template <typename Test>
+inline ray_benchmark_result time_box_tests(const char* name, const std::vector<ray>& rays,
+                                           const std::vector<aabb>& boxes, int passes, Test test) {
+    ray_benchmark_result result{name, rays.size() * boxes.size(), 0, infinity};
+    for (int pass = 0; pass < passes; pass++) {
+        size_t hits = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (const auto& r : rays)
+            hits += test(r, boxes);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        result.hits = hits;
+        result.seconds = std::min(result.seconds, elapsed.count());
+    }
+    return result;
+}
+
+inline void run_ray_benchmark(const scene& s, int image_width, int image_height, uint64_t seed,
+                              int passes = 5) {
+    camera cam = s.make_camera();
+    std::vector<ray> primary, secondary;
+    primary.reserve(size_t(image_width) * image_height);
+    secondary.reserve(size_t(image_width) * image_height);
+
+    hit_record rec;
+    for (int j = 0; j < image_height; j++) {
+        for (int i = 0; i < image_width; i++) {
+            sampler rng(seed, i, j);
+            auto u = (i + rng.random_double()) / (image_width-1);
+            auto v = (j + rng.random_double()) / (image_height-1);
+            ray r = cam.get_ray(u, v, rng);
+            primary.push_back(r);
+
+            if (s.world.hit(r, 0.001, infinity, rec))
+                secondary.emplace_back(rec.p, rec.normal + random_unit_vector(rng), r.time());
+        }
+    }
+
+    printf("%-10s %10s %10s %10s %10s\n", "rays", "count", "hits", "seconds", "Mrays/s");
+    for (auto result : { time_rays("primary", s.world, primary, passes),
+                         time_rays("secondary", s.world, secondary, passes),
+                         time_rays("occluded", s.world, secondary, passes, true) }) {
+        printf("%-10s %10zu %10zu %10.4f %10.3f\n", result.name, result.rays, result.hits,
+               result.seconds, result.mrays_per_second());
+    }
+
+    aabb world_box;
+    if (!s.world.bounding_box(s.time0, s.time1, world_box))
+        return;
+    std::vector<aabb> boxes;
+    auto extent = world_box.max() - world_box.min();
+    sampler rng(seed, 0, 0);
+    for (int b = 0; b < 64; b++) {
+        point3 corner;
+        vec3 size;
+        for (int a = 0; a < 3; a++) {
+            corner[a] = world_box.min()[a] + rng.random_double() * extent[a];
+            size[a] = rng.random_double() * 0.25 * extent[a];
+        }
+        boxes.emplace_back(corner, corner + size);
+    }
+
+    printf("\n%-10s %10s %10s %10s %10s\n", "box tests", "count", "hits", "seconds", "M/s");
+    auto dividing = time_box_tests("dividing", primary, boxes, passes,
+        [](const ray& r, const std::vector<aabb>& boxes) {
+            size_t hits = 0;
+            for (const auto& box : boxes)
+                hits += slab_test_dividing(box, r, 0.001, infinity);
+            return hits;
+        });
+    auto precomputed = time_box_tests("traversal", primary, boxes, passes,
+        [](const ray& r, const std::vector<aabb>& boxes) {
+            const traversal_ray tr(r);
+            size_t hits = 0;
+            for (const auto& box : boxes)
+                hits += slab_test_precomputed(box, tr, 0.001, infinity);
+            return hits;
+        });
+    for (auto result : { dividing, precomputed }) {
+        printf("%-10s %10zu %10zu %10.4f %10.3f\n", result.name, result.rays, result.hits,
+               result.seconds, result.mrays_per_second());
+    }
+}
+
+#endif
@@ -3,42 +3,98 @@
 
 #include "rtweekend.h"
 
-#include "aarect.h"
-#include "hittable_list.h"
+#include "hittable.h"
 
+// An axis-aligned box, intersected directly with one slab test rather than as six rects.
+// The face hit is the one on the axis where the ray enters the box, or where it leaves if
+// it starts inside, and the normal points out of the box. u and v run along the face the
+// way they do on the xy_rect, xz_rect or yz_rect that would cover it.
 class box : public hittable {
     public:
         box () {}
-        box (const point3& p0, const point3& p1, shared_ptr<material> ptr);
+        box (const point3& p0, const point3& p1, const material* ptr)
+            : box_min(p0), box_max(p1), mp(ptr) {}
 
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+            double t;
+            int axis;
+            bool exiting;
+            return intersect(r, t_min, t_max, t, axis, exiting);
+        }
+
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
             output_box = aabb(box_min, box_max);
             return true;
         }
+
     private:
         point3 box_min;
         point3 box_max;
-        hittable_list sides;
+        const material* mp;
+
+        // Where r first meets the surface between t_min and t_max: the distance, the axis
+        // of the face, and whether the ray is leaving the box there.
+        bool intersect(const ray& r, double t_min, double t_max, double& t, int& axis,
+                       bool& exiting) const;
 };
 
-box::box(const point3& p0, const point3& p1, shared_ptr<material> ptr) {
-    box_min = p0;
-    box_max = p1;
+bool box::intersect(const ray& r, double t_min, double t_max, double& t, int& axis,
+                    bool& exiting) const {
+    double t_enter = -infinity, t_exit = infinity;
+    int enter_axis = 0, exit_axis = 0;
 
-    sides.add(make_shared<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ptr));
-    sides.add(make_shared<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), ptr));
+    for (int a = 0; a < 3; a++) {
+        // The same plane distances the rects compute. An axis the ray runs parallel to
+        // gives infinities, or NaNs in a face's plane, which the comparisons skip.
+        auto t0 = (box_min[a] - r.origin()[a]) / r.direction()[a];
+        auto t1 = (box_max[a] - r.origin()[a]) / r.direction()[a];
+        if (t0 > t1)
+            std::swap(t0, t1);
+        if (t0 > t_enter) { t_enter = t0; enter_axis = a; }
+        if (t1 < t_exit)  { t_exit = t1;  exit_axis = a; }
+    }
 
-    sides.add(make_shared<xz_rect>(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), ptr));
-    sides.add(make_shared<xz_rect>(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), ptr));
+    if (t_enter > t_exit)
+        return false;
 
-    sides.add(make_shared<yz_rect>(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), ptr));
-    sides.add(make_shared<yz_rect>(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), ptr));
+    if (t_enter >= t_min && t_enter <= t_max) {
+        t = t_enter;
+        axis = enter_axis;
+        exiting = false;
+        return true;
+    }
+    if (t_exit >= t_min && t_exit <= t_max) {
+        t = t_exit;
+        axis = exit_axis;
+        exiting = true;
+        return true;
+    }
+    return false;
 }
 
 bool box::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    return sides.hit(r, t_min, t_max, rec);
+    double t;
+    int axis;
+    bool exiting;
+    if (!intersect(r, t_min, t_max, t, axis, exiting))
+        return false;
+
+    rec.t = t;
+    rec.p = r.at(t);
+
+    // A ray going up an axis enters through the min face and leaves through the max face.
+    vec3 outward_normal(0, 0, 0);
+    outward_normal[axis] = (r.direction()[axis] > 0) == exiting ? 1 : -1;
+    rec.set_face_normal(r, outward_normal);
+
+    int u_axis = axis == 0 ? 1 : 0;
+    int v_axis = axis == 2 ? 1 : 2;
+    rec.u = (rec.p[u_axis] - box_min[u_axis]) / (box_max[u_axis] - box_min[u_axis]);
+    rec.v = (rec.p[v_axis] - box_min[v_axis]) / (box_max[v_axis] - box_min[v_axis]);
+    rec.mat_ptr = mp;
+    return true;
 }
 
-#endif
\ No newline at end of file
+#endif
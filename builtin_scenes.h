@@ -0,0 +1,511 @@
+#ifndef BUILTIN_SCENES_H
+#define BUILTIN_SCENES_H
+
+#include "rtweekend.h"
+
+#include "aarect.h"
+#include "box.h"
+#include "bvh.h"
+#include "constant_medium.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "material.h"
+#include "moving_sphere.h"
+#include "perlin.h"
+#include "scene.h"
+#include "sphere.h"
+#include "sphere_set.h"
+#include "texture.h"
+#include "triangle_mesh.h"
+
+#include <cstring>
+
+// Scenes compiled into the tracer, selectable at runtime with --scene NAME. Each builder
+// fills in the geometry along with the camera and image settings the scene was set up
+// for; command-line options override the latter. The settings are also available on their
+// own, for a --workers coordinator that never traces the scene.
+
+void random_scene_settings(scene& s) {
+    s.background = color(0.70, 0.80, 1.00);
+    s.aspect_ratio = 16.0 / 9.0;
+    s.image_width = 400;
+    s.lookfrom = point3(13,2,3);
+    s.lookat = point3(0,0,0);
+    s.vfov = 20.0;
+    s.aperture = 0.1;
+}
+
+scene random_scene() {
+    scene s;
+    hittable_list world;
+
+    auto checker = make_shared<checker_texture>(color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, s.materials.add<lambertian>(checker)));
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+
+            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
+                const material* sphere_material;
+
+                if (choose_mat < 0.8) {
+                    // diffuse
+                    auto albedo = color::random() * color::random();
+                    sphere_material = s.materials.add<lambertian>(albedo);
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                } else if (choose_mat < 0.95) {
+                    // metal
+                    auto albedo = color::random(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    sphere_material = s.materials.add<metal>(albedo, fuzz);
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                } else {
+                    // glass
+                    sphere_material = s.materials.add<dielectric>(1.5);
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                }
+            }
+        }
+    }
+
+    auto material1 = s.materials.add<dielectric>(1.5);
+    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+
+    auto material2 = s.materials.add<lambertian>(color(0.4, 0.2, 0.1));
+    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = s.materials.add<metal>(color(0.7, 0.6, 0.5), 0.0);
+    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+
+    s.world = hittable_list(make_shared<bvh_node>(world, 1.0, 1.0));
+    random_scene_settings(s);
+    return s;
+}
+
+void two_spheres_settings(scene& s) {
+    s.background = color(0.70, 0.80, 1.00);
+    s.aspect_ratio = 16.0 / 9.0;
+    s.image_width = 400;
+    s.lookfrom = point3(0,1,-10);
+    s.lookat = point3(0,1,0);
+    s.vfov = 20.0;
+}
+
+scene two_spheres() {
+    scene s;
+
+    auto checker = make_shared<checker_texture>(color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
+    auto moon_texture = make_shared<image_texture>("moon.jpg");
+
+    s.world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, s.materials.add<lambertian>(checker)));
+    s.world.add(make_shared<sphere>(point3(1, 1, 0), 1, s.materials.add<lambertian>(moon_texture)));
+    s.world.add(make_shared<sphere>(point3(-1, 1, 0), 1, s.materials.add<lambertian>(color(0.5, 0.5, 0.5))));
+
+    two_spheres_settings(s);
+    return s;
+}
+
+void two_perlin_spheres_settings(scene& s) {
+    s.background = color(0.70, 0.80, 1.00);
+    s.aspect_ratio = 16.0 / 9.0;
+    s.image_width = 400;
+    s.lookfrom = point3(13,2,3);
+    s.lookat = point3(0,0,0);
+    s.vfov = 20.0;
+}
+
+scene two_perlin_spheres() {
+    scene s;
+
+    auto pertext = make_shared<noise_texture>(pi);
+    s.world.add(make_shared<sphere>(point3(0,-1000,0), 1000, s.materials.add<lambertian>(pertext)));
+    s.world.add(make_shared<sphere>(point3(0,2,0), 2, s.materials.add<lambertian>(pertext)));
+
+    two_perlin_spheres_settings(s);
+    return s;
+}
+
+void bubble_settings(scene& s) {
+    s.background = color(0.70, 0.80, 1.00);
+    s.aspect_ratio = 16.0 / 9.0;
+    s.image_width = 400;
+    s.samples_per_pixel = 250;
+    s.lookfrom = point3(26,3,6);
+    s.lookat = point3(0,2,0);
+    s.vfov = 10.0;
+}
+
+scene bubble() {
+    scene s;
+
+    s.world.add(make_shared<sphere>(point3(0,-1000,0), 1000, s.materials.add<lambertian>(color(.50, .8, 0.23))));
+
+    auto bubbletex = make_shared<bubble_texture>(pi);
+    s.world.add(make_shared<sphere>(point3(0,2,0), -1.99, s.materials.add<dielectric>(1.0, bubbletex)));
+    s.world.add(make_shared<sphere>(point3(0,2,0), 2, s.materials.add<dielectric>(1.0, bubbletex)));
+
+    auto difflight = s.materials.add<diffuse_light>(color(5,5,5));
+    auto panel = make_shared<xy_rect>(3, 7, 1, 5, -5, difflight);
+    s.world.add(panel);
+    s.lights = panel;
+
+    bubble_settings(s);
+    return s;
+}
+
+void moon_settings(scene& s) {
+    s.aspect_ratio = 16.0 / 9.0;
+    s.image_width = 400;
+    s.samples_per_pixel = 1000;
+    s.lookfrom = point3(13,2,3);
+    s.lookat = point3(0,0,0);
+    s.vfov = 20.0;
+}
+
+scene moon() {
+    scene s;
+
+    auto light = s.materials.add<diffuse_light>(color(10, 10, 10));
+    auto sun = make_shared<sphere>(point3(30,0,0), 5, light);
+    s.world.add(sun);
+    s.lights = sun;
+
+    auto moon_texture = make_shared<image_texture>("moon.jpg");
+    s.world.add(make_shared<sphere>(point3(0,0,0), 2, s.materials.add<lambertian>(moon_texture)));
+
+    moon_settings(s);
+    return s;
+}
+
+void simple_light_settings(scene& s) {
+    s.aspect_ratio = 16.0 / 9.0;
+    s.image_width = 400;
+    s.samples_per_pixel = 400;
+    s.lookfrom = point3(26,3,6);
+    s.lookat = point3(0,2,0);
+    s.vfov = 20.0;
+}
+
+scene simple_light() {
+    scene s;
+
+    auto pertext = make_shared<noise_texture>(10);
+    shared_ptr<hittable> sphere1 = make_shared<sphere>(point3(0,100,0), 100, s.materials.add<lambertian>(pertext));
+    s.world.add(make_shared<constant_medium>(sphere1, 0.01, s.materials.add<isotropic>(pertext),
+                                             s.next_medium_stream()));
+    s.world.add(make_shared<sphere>(point3(0,-1000,0), 1000, s.materials.add<lambertian>(pertext)));
+
+    s.world.add(make_shared<sphere>(point3(0,2,0), 2, s.materials.add<dielectric>(1.5)));
+    shared_ptr<hittable> boundary = make_shared<sphere>(point3(0,2,0), 1.99, s.materials.add<lambertian>(pertext));
+    s.world.add(make_shared<constant_medium>(boundary, .2, s.materials.add<isotropic>(pertext),
+                                             s.next_medium_stream()));
+
+    auto difflight = s.materials.add<diffuse_light>(color(5,5,5));
+    auto panel = make_shared<xy_rect>(3, 7, 1, 5, -5, difflight);
+    s.world.add(panel);
+    s.lights = panel;
+
+    simple_light_settings(s);
+    return s;
+}
+
+void cornell_box_settings(scene& s) {
+    s.aspect_ratio = 1.0;
+    s.image_width = 600;
+    s.samples_per_pixel = 1000;
+    s.lookfrom = point3(278, 278, -800);
+    s.lookat = point3(278, 278, 0);
+    s.vfov = 40.0;
+}
+
+scene cornell_box() {
+    scene s;
+
+    auto red   = s.materials.add<lambertian>(color(.65, .05, .05));
+    auto white = s.materials.add<lambertian>(color(.73, .73, .73));
+    auto green = s.materials.add<lambertian>(color(.12, .45, .15));
+    auto light = s.materials.add<diffuse_light>(color(15, 15, 15));
+
+    s.world.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
+    s.world.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
+    auto lamp = make_shared<flip_face>(make_shared<xz_rect>(213, 343, 227, 332, 554, light));
+    s.world.add(lamp);
+    s.lights = lamp;
+    s.world.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
+    s.world.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
+    s.world.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
+
+    shared_ptr<hittable> box1 = make_shared<box>(point3(0,0,0), point3(165,330,165), white);
+    box1 = make_shared<rotate_y>(box1, 15);
+    box1 = make_shared<translate>(box1, vec3(265,0,295));
+    s.world.add(box1);
+
+    shared_ptr<hittable> box2 = make_shared<box>(point3(0,0,0), point3(165,165,165), white);
+    box2 = make_shared<rotate_y>(box2, -18);
+    box2 = make_shared<translate>(box2, vec3(130,0,65));
+    s.world.add(box2);
+
+    cornell_box_settings(s);
+    return s;
+}
+
+void final_scene_settings(scene& s) {
+    s.aspect_ratio = 1.0;
+    s.image_width = 800;
+    s.samples_per_pixel = 5000;
+    s.lookfrom = point3(478, 278, -600);
+    s.lookat = point3(278, 278, 0);
+    s.vfov = 40.0;
+}
+
+scene final_scene() {
+    scene s;
+    hittable_list boxes1;
+    auto ground = s.materials.add<lambertian>(color(0.48, 0.83, 0.53));
+
+    const int boxes_per_side = 20;
+    for (int i = 0; i < boxes_per_side; i++) {
+        for (int j = 0; j < boxes_per_side; j++) {
+            auto w = 100.0;
+            auto x0 = -1000.0 + i*w;
+            auto z0 = -1000.0 + j*w;
+            auto y0 = 0.0;
+            auto x1 = x0 + w;
+            auto y1 = random_double(1,101);
+            auto z1 = z0 + w;
+
+            boxes1.add(make_shared<box>(point3(x0,y0,z0), point3(x1,y1,z1), ground));
+        }
+    }
+
+    hittable_list& objects = s.world;
+
+    objects.add(make_shared<bvh_node>(boxes1, 0, 1));
+
+    auto light = s.materials.add<diffuse_light>(color(7, 7, 7));
+    auto lamp = make_shared<flip_face>(make_shared<xz_rect>(123, 423, 147, 412, 554, light));
+    objects.add(lamp);
+    s.lights = lamp;
+
+    auto center1 = point3(400, 400, 200);
+    auto center2 = center1 + vec3(30,0,0);
+    auto moving_sphere_material = s.materials.add<lambertian>(color(0.7, 0.3, 0.1));
+    objects.add(make_shared<moving_sphere>(center1, center2, 0, 1, 50, moving_sphere_material));
+
+    objects.add(make_shared<sphere>(point3(260, 150, 45), 50, s.materials.add<dielectric>(1.5)));
+    objects.add(make_shared<sphere>(
+        point3(0, 150, 145), 50, s.materials.add<metal>(color(0.8, 0.8, 0.9), 1.0)
+    ));
+
+    auto boundary = make_shared<sphere>(point3(360,150,145), 70, s.materials.add<dielectric>(1.5));
+    objects.add(boundary);
+    objects.add(make_shared<constant_medium>(boundary, 0.2, s.materials.add<isotropic>(color(0.2, 0.4, 0.9)),
+                                             s.next_medium_stream()));
+    boundary = make_shared<sphere>(point3(0, 0, 0), 5000, s.materials.add<dielectric>(1.5));
+    objects.add(make_shared<constant_medium>(boundary, .0001, s.materials.add<isotropic>(color(1,1,1)),
+                                             s.next_medium_stream()));
+
+    auto emat = s.materials.add<lambertian>(make_shared<image_texture>("earthmap.jpg"));
+    objects.add(make_shared<sphere>(point3(400,200,400), 100, emat));
+    auto pertext = make_shared<noise_texture>(0.1);
+    objects.add(make_shared<sphere>(point3(220,280,300), 80, s.materials.add<lambertian>(pertext)));
+
+    std::vector<point3> centers;
+    auto white = s.materials.add<lambertian>(color(.73, .73, .73));
+    int ns = 1000;
+    for (int j = 0; j < ns; j++) {
+        centers.push_back(point3::random(0,165));
+    }
+
+    objects.add(make_shared<instance>(
+        make_shared<sphere_set>(centers, std::vector<double>(ns, 10),
+                                std::vector<const material*>(ns, white)),
+        affine_transform::translation(vec3(-100,270,395)) * affine_transform::rotation(vec3(0,1,0), 15)
+    ));
+
+    final_scene_settings(s);
+    return s;
+}
+
+// A two-level hierarchy: one bottom-level BVH over a cluster of spheres, placed thousands
+// of times under random rotations and scales, with a top-level BVH over the placements.
+// Memory goes with the one cluster, not with the half a million spheres on screen.
+void instances_settings(scene& s) {
+    s.background = color(0.70, 0.80, 1.00);
+    s.aspect_ratio = 16.0 / 9.0;
+    s.image_width = 400;
+    s.samples_per_pixel = 100;
+    s.lookfrom = point3(13,4,9);
+    s.lookat = point3(0,0,0);
+    s.vfov = 30.0;
+}
+
+scene instances() {
+    scene s;
+
+    hittable_list cluster;
+    const material* palette[] = {
+        s.materials.add<lambertian>(color(0.8, 0.3, 0.2)),
+        s.materials.add<lambertian>(color(0.2, 0.5, 0.8)),
+        s.materials.add<metal>(color(0.9, 0.8, 0.6), 0.1),
+        s.materials.add<dielectric>(1.5),
+    };
+    for (int i = 0; i < 200; i++) {
+        auto center = 0.8 * random_in_unit_sphere();
+        cluster.add(make_shared<sphere>(center, random_double(0.05, 0.15), palette[i % 4]));
+    }
+    auto blas = make_shared<bvh_node>(cluster, 0, 1);
+
+    hittable_list placements;
+    for (int a = -30; a < 30; a++) {
+        for (int b = -30; b < 30; b++) {
+            auto size = random_double(0.2, 0.45);
+            point3 position(a + random_double(0, 0.5), size, b + random_double(0, 0.5));
+            auto to_world = affine_transform::translation(position)
+                          * affine_transform::rotation(random_unit_vector(), random_double(0, 360))
+                          * affine_transform::scaling(vec3(size, size, size));
+            placements.add(make_shared<instance>(blas, to_world));
+        }
+    }
+    s.world.add(make_shared<bvh_node>(placements, 0, 1));
+
+    auto checker = make_shared<checker_texture>(color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
+    s.world.add(make_shared<sphere>(point3(0,-1000,0), 1000, s.materials.add<lambertian>(checker)));
+
+    instances_settings(s);
+    return s;
+}
+
+// A noise-displaced sphere tessellated into two million triangles, one triangle_mesh,
+// lit by a rect light. Stands in for a scanned model without shipping one.
+void triangles_settings(scene& s) {
+    s.background = color(0.30, 0.35, 0.45);
+    s.aspect_ratio = 16.0 / 9.0;
+    s.image_width = 400;
+    s.samples_per_pixel = 100;
+    s.lookfrom = point3(6,3,6);
+    s.lookat = point3(0,1,0);
+    s.vfov = 30.0;
+}
+
+scene triangles() {
+    scene s;
+
+    const int rings = 700, segments = 1400;
+    perlin noise;
+    std::vector<float> positions;
+    positions.reserve(3 * size_t(rings + 1) * segments);
+    for (int i = 0; i <= rings; i++) {
+        auto theta = pi * i / rings;
+        for (int j = 0; j < segments; j++) {
+            auto phi = 2 * pi * j / segments;
+            vec3 direction(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+            auto radius = 1 + 0.15 * noise.turb(4 * direction);
+            auto p = radius * direction;
+            positions.insert(positions.end(), { float(p.x()), float(p.y() + 1.2), float(p.z()) });
+        }
+    }
+
+    std::vector<uint32_t> indices;
+    indices.reserve(6 * size_t(rings) * segments);
+    for (int i = 0; i < rings; i++) {
+        for (int j = 0; j < segments; j++) {
+            uint32_t a = i * segments + j, b = i * segments + (j + 1) % segments;
+            uint32_t c = a + segments, d = b + segments;
+            indices.insert(indices.end(), { a, c, b, b, c, d });
+        }
+    }
+
+    s.world.add(make_shared<triangle_mesh>(std::move(positions), std::move(indices),
+                                           s.materials.add<lambertian>(color(0.8, 0.6, 0.4))));
+
+    auto checker = make_shared<checker_texture>(color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
+    s.world.add(make_shared<sphere>(point3(0,-1000,0), 1000, s.materials.add<lambertian>(checker)));
+
+    auto lamp = make_shared<flip_face>(
+        make_shared<xz_rect>(-2, 2, -2, 2, 6, s.materials.add<diffuse_light>(color(6, 6, 6))));
+    s.world.add(lamp);
+    s.lights = lamp;
+
+    triangles_settings(s);
+    return s;
+}
+
+// A million small spheres swirled into a flat spiral above a checkered ground, all in one
+// sphere_set.
+void particles_settings(scene& s) {
+    s.background = color(0.70, 0.80, 1.00);
+    s.aspect_ratio = 16.0 / 9.0;
+    s.image_width = 400;
+    s.samples_per_pixel = 64;
+    s.lookfrom = point3(0,6,8);
+    s.lookat = point3(0,1,0);
+    s.vfov = 40.0;
+}
+
+scene particles() {
+    scene s;
+
+    const material* palette[] = {
+        s.materials.add<lambertian>(color(0.9, 0.6, 0.3)),
+        s.materials.add<lambertian>(color(0.3, 0.5, 0.9)),
+        s.materials.add<lambertian>(color(0.9, 0.9, 0.9)),
+        s.materials.add<metal>(color(0.9, 0.8, 0.6), 0.2),
+    };
+
+    const int count = 1000000;
+    std::vector<point3> centers;
+    std::vector<double> radii;
+    std::vector<const material*> materials;
+    centers.reserve(count);
+    radii.reserve(count);
+    materials.reserve(count);
+    for (int i = 0; i < count; i++) {
+        auto r = 3 * sqrt(random_double());
+        auto arm = random_int(0, 2);
+        auto angle = 2*pi*arm/3 + 1.5*r + random_double(-0.4, 0.4);
+        auto height = 1.2 + 0.15 * (random_double() + random_double() - 1) * (3 - r);
+        centers.push_back(point3(r * cos(angle), height, r * sin(angle)));
+        radii.push_back(random_double(0.004, 0.012));
+        materials.push_back(palette[arm == 0 && random_double() < 0.2 ? 3 : arm]);
+    }
+    s.world.add(make_shared<sphere_set>(centers, radii, materials));
+
+    auto checker = make_shared<checker_texture>(color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
+    s.world.add(make_shared<sphere>(point3(0,-1000,0), 1000, s.materials.add<lambertian>(checker)));
+
+    particles_settings(s);
+    return s;
+}
+
+struct builtin_scene {
+    const char* name;
+    const char* description;
+    scene (*build)();
+    void (*settings)(scene&);   // what build() sets besides the geometry
+};
+
+const builtin_scene builtin_scenes[] = {
+    { "random_scene",       "Book one cover: a field of random spheres",          random_scene, random_scene_settings },
+    { "two_spheres",        "Checkered ground with a textured moon sphere",      two_spheres, two_spheres_settings },
+    { "two_perlin_spheres", "Two perlin-noise spheres",                          two_perlin_spheres, two_perlin_spheres_settings },
+    { "bubble",             "A soap bubble with a procedural film texture",      bubble, bubble_settings },
+    { "moon",               "The moon lit by a distant spherical light",         moon, moon_settings },
+    { "simple_light",       "Noise-textured fog spheres under an area light",    simple_light, simple_light_settings },
+    { "cornell_box",        "Ye olde Cornell box with two diffuse boxes",        cornell_box, cornell_box_settings },
+    { "final_scene",        "Book two final scene: boxes, fog, glass and noise", final_scene, final_scene_settings },
+    { "instances",          "3600 instances of one sphere cluster on two BVH levels", instances, instances_settings },
+    { "triangles",          "A displaced sphere of two million triangles in one mesh", triangles, triangles_settings },
+    { "particles",          "A million small spheres in a spiral, in one sphere_set", particles, particles_settings },
+};
+
+inline const builtin_scene* find_builtin_scene(const char* name) {
+    for (auto& entry : builtin_scenes)
+        if (strcmp(entry.name, name) == 0)
+            return &entry;
+    return nullptr;
+}
+
+#endif
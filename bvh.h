@@ -17,113 +17,1145 @@
 #include "hittable_list.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include <vector>
 
 
+// One node of the flattened hierarchy. Bounds are stored as floats rounded outward, so a
+// node's box always contains its double precision box and a node fits in 32 bytes, two
+// to a cache line. Nodes are laid out depth first: an interior node's first child is the
+// next node in the array and offset is the index of its second child. A leaf (count > 0)
+// covers primitives [offset, offset + count).
+struct alignas(32) bvh_flat_node {
+    float corner[2][3];     // min and max corners, indexed by traversal_ray::sign
+    uint32_t offset;
+    uint16_t count;
+    uint16_t axis;      // split axis of an interior node; its first child is on the low side
+
+    void set_bounds(const aabb& box) {
+        for (int a = 0; a < 3; a++) {
+            corner[0][a] = round_down(box.min()[a]);
+            corner[1][a] = round_up(box.max()[a]);
+        }
+    }
+
+    aabb bounds() const {
+        return aabb(point3(corner[0][0], corner[0][1], corner[0][2]),
+                    point3(corner[1][0], corner[1][1], corner[1][2]));
+    }
+
+    // The same branchless slab test as aabb::hit(const traversal_ray&, ...).
+    bool hit(const traversal_ray& r, double t_min, double t_max) const {
+        for (int a = 0; a < 3; a++) {
+            auto t0 = (corner[r.sign[a]][a] - r.origin[a]) * r.inv_dir[a];
+            auto t1 = (corner[1 - r.sign[a]][a] - r.origin[a]) * r.inv_dir[a] * slab_far_scale;
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+        }
+        return t_min < t_max;
+    }
+
+    static float round_down(double x) {
+        float f = static_cast<float>(x);
+        return f > x ? std::nextafter(f, -INFINITY) : f;
+    }
+
+    static float round_up(double x) {
+        float f = static_cast<float>(x);
+        return f < x ? std::nextafter(f, INFINITY) : f;
+    }
+};
+
+static_assert(sizeof(bvh_flat_node) == 32, "bvh_flat_node should fill half a cache line");
+
+
+// A node of a W-ary hierarchy (W = 4 or 8), made by collapsing levels of the binary tree.
+// Child bounds are stored structure-of-arrays, so the slab test runs on vdouble::width
+// children per instruction: one AVX pass per axis tests all four children of a BVH4 node.
+// Bounds are floats, rounded outward as in bvh_flat_node, and widen to double exactly on
+// load, so a child is hit exactly when the binary node it came from would be.
+//
+// child[i] is a node index when count[i] is 0 and the first primitive of a leaf otherwise.
+// Unused slots have empty bounds (min > max), which no ray hits.
+template <int W>
+struct alignas(32) bvh_wide_node {
+    static constexpr int width = W;
+
+    float corner[2][3][W];      // [min or max][axis][child], indexed by traversal_ray::sign
+    uint32_t child[W];
+    uint8_t count[W];
+
+    void clear() {
+        for (int i = 0; i < W; i++) {
+            for (int a = 0; a < 3; a++) {
+                corner[0][a][i] = INFINITY;
+                corner[1][a][i] = -INFINITY;
+            }
+            child[i] = 0;
+            count[i] = 0;
+        }
+    }
+
+    void set_child(int i, const bvh_flat_node& node, uint32_t index) {
+        for (int a = 0; a < 3; a++) {
+            corner[0][a][i] = node.corner[0][a];
+            corner[1][a][i] = node.corner[1][a];
+        }
+        child[i] = index;
+        count[i] = static_cast<uint8_t>(node.count);
+    }
+
+    aabb bounds(int i) const {
+        return aabb(point3(corner[0][0][i], corner[0][1][i], corner[0][2][i]),
+                    point3(corner[1][0][i], corner[1][1][i], corner[1][2][i]));
+    }
+
+    // Slab test of one ray against every child. Returns a bit per child hit and stores
+    // where the ray enters each child's box in t_entry.
+    uint32_t hit(const traversal_ray& r, double t_min, double t_max, double* t_entry) const {
+        const vdouble ox(r.origin.x()), oy(r.origin.y()), oz(r.origin.z());
+        const vdouble ix(r.inv_dir.x()), iy(r.inv_dir.y()), iz(r.inv_dir.z());
+        const vdouble far_scale(slab_far_scale);
+        const float* near_x = corner[r.sign[0]][0];
+        const float* far_x  = corner[1 - r.sign[0]][0];
+        const float* near_y = corner[r.sign[1]][1];
+        const float* far_y  = corner[1 - r.sign[1]][1];
+        const float* near_z = corner[r.sign[2]][2];
+        const float* far_z  = corner[1 - r.sign[2]][2];
+
+        uint32_t hits = 0;
+        for (int c = 0; c < W; c += vdouble::width) {
+            // The ::max/::min operand order keeps lo and hi where a t is NaN, as aabb::hit does.
+            vdouble lo(t_min), hi(t_max);
+            lo = ::max((vdouble::load(near_x + c) - ox) * ix, lo);
+            hi = ::min((vdouble::load(far_x + c) - ox) * ix * far_scale, hi);
+            lo = ::max((vdouble::load(near_y + c) - oy) * iy, lo);
+            hi = ::min((vdouble::load(far_y + c) - oy) * iy * far_scale, hi);
+            lo = ::max((vdouble::load(near_z + c) - oz) * iz, lo);
+            hi = ::min((vdouble::load(far_z + c) - oz) * iz * far_scale, hi);
+            lo.store(t_entry + c);
+            hits |= static_cast<uint32_t>((lo < hi).bits()) << c;
+        }
+        return hits;
+    }
+};
+
+static_assert(sizeof(bvh_wide_node<4>) == 128, "bvh_wide_node<4> should fill two cache lines");
+static_assert(sizeof(bvh_wide_node<8>) == 256, "bvh_wide_node<8> should fill four cache lines");
+
+
+// Knobs for the SAH builder. Costs are relative: what matters is how expensive visiting a
+// node is compared with testing one primitive.
+struct bvh_build_settings {
+    int max_leaf_size = 4;              // leaves never hold more primitives than this
+    int bins = 16;                      // per axis; every boundary between bins is a candidate split
+    double traversal_cost = 1.0;
+    double intersection_cost = 1.0;
+    int num_threads = 0;                // 0 uses every core
+    uint32_t parallel_threshold = 4096; // smaller subtrees are built on the thread that reaches them
+    int width = 8;                      // children per node for traversal: 2, 4 or 8
+    bool report = false;                // print the build stats to std::cerr
+};
+
+// The settings bvh_node uses when it isn't given any, e.g. from the command line.
+inline bvh_build_settings& default_bvh_settings() {
+    static bvh_build_settings settings;
+    return settings;
+}
+
+
+// How long a build took and how good the tree is. sah_cost is the expected cost of a
+// random ray through the root under the settings' cost model, so lower is better and it
+// compares trees over the same primitives.
+struct bvh_build_stats {
+    double seconds = 0.0;
+    double sah_cost = 0.0;
+    int threads = 1;
+    size_t leaves = 0;
+    int depth = 0;
+};
+
+
+// A bounding volume hierarchy over primitives it knows only by index and bounds, built top
+// down with the binned surface area heuristic into one contiguous array of bvh_flat_node.
+// For width 4 or 8 the binary tree is then collapsed into bvh_wide_node arrays, which cut
+// the number of nodes a ray visits and test all children of a node at once. Either way
+// traversal uses an explicit stack instead of recursive virtual calls.
+//
+// What a leaf holds is up to the owner: leaves cover ranges of the leaf order build()
+// returns, and the traversals hand those ranges to a callback. bvh_node keeps hittables
+// in that order; triangle_mesh keeps triangles.
+//
+// Large builds run on several threads: subtrees above parallel_threshold primitives are
+// handed to idle threads, and the biggest nodes bin their primitives in parallel chunks.
+// Every split decision depends only on the primitives, so the tree is the same whatever
+// the thread count.
+class bvh_tree {
+    public:
+        // Builds the tree over primitives 0 to n-1. bounds_of(i, box) stores primitive i's
+        // bounds in box and returns false if it has none. order receives the primitive
+        // indices in leaf order, which is what leaf ranges index into.
+        template <typename Bounds>
+        void build(uint32_t n, const bvh_build_settings& settings, Bounds bounds_of,
+                   std::vector<uint32_t>& order);
+
+        // Closest-hit traversal. leaf(first, count, t_max) tests leaf order entries
+        // [first, first + count) against the ray out to t_max, lowers t_max to the nearest
+        // hit, and returns whether there was one. Returns whether any leaf hit.
+        template <typename Leaf>
+        bool closest_hit(const ray& r, double t_min, double t_max, Leaf leaf) const;
+
+        // Any-hit traversal: returns as soon as leaf(first, count) reports a hit.
+        template <typename Leaf>
+        bool any_hit(const ray& r, double t_min, double t_max, Leaf leaf) const;
+
+        // closest_hit() and any_hit() from a given node down, for packet traversals that
+        // finish a subtree with a single ray.
+        template <int W, typename Leaf>
+        bool closest_hit_wide(const std::vector<bvh_wide_node<W>>& wide, uint32_t root, const ray& r,
+                              double t_min, double t_max, Leaf leaf) const;
+        template <typename Leaf>
+        bool closest_hit_binary(int root, const ray& r, double t_min, double t_max, Leaf leaf) const;
+        template <int W, typename Leaf>
+        bool any_hit_wide(const std::vector<bvh_wide_node<W>>& wide, uint32_t root, const ray& r,
+                          double t_min, double t_max, Leaf leaf) const;
+        template <typename Leaf>
+        bool any_hit_binary(int root, const ray& r, double t_min, double t_max, Leaf leaf) const;
+
+        static constexpr int max_depth = 64;
+
+    public:
+        std::vector<bvh_flat_node> nodes;               // binary tree; empty once collapsed
+        std::vector<bvh_wide_node<4>> nodes4;           // used when width is 4
+        std::vector<bvh_wide_node<8>> nodes8;           // used when width is 8
+        aabb box;
+        int width = 2;
+        bvh_build_stats stats;
+
+    private:
+        static constexpr int max_sah_depth = 32;    // median splits below this keep the stack bounded
+        static constexpr int max_chunks = 64;       // most pieces for_each_chunk cuts a range into
+
+        // What the builder knows about one primitive, so its bounds are fetched once
+        // instead of inside every comparison. The builder partitions these in place, which
+        // keeps each subtree's primitives contiguous in memory.
+        struct build_primitive {
+            aabb bounds;
+            point3 centroid;
+            uint32_t index;     // the primitive's own index
+        };
+
+        struct build_bin {
+            aabb bounds;
+            uint32_t count;
+        };
+
+        // Binning space for one thread; a node is done with it before it recurses.
+        struct build_scratch {
+            std::vector<build_bin> bins[3];
+            std::vector<double> right_area;
+            std::vector<uint32_t> right_count;
+
+            explicit build_scratch(int num_bins) : right_area(num_bins), right_count(num_bins) {
+                for (auto& axis_bins : bins)
+                    axis_bins.resize(num_bins);
+            }
+        };
+
+        struct build_context {
+            bvh_build_settings settings;
+            std::vector<build_primitive> prims;
+            std::atomic<int> idle_threads{0};
+        };
+
+        static aabb build_subtree(build_context& ctx, build_scratch& scratch, uint32_t begin,
+                                  uint32_t end, int depth, std::vector<bvh_flat_node>& out);
+        static int borrow_threads(build_context& ctx, int wanted);
+        template <typename F>
+        static int for_each_chunk(build_context& ctx, uint32_t begin, uint32_t end, F fn);
+
+        void compute_stats(const bvh_build_settings& settings);
+        template <int W>
+        uint32_t collapse(std::vector<bvh_wide_node<W>>& out, uint32_t index) const;
+};
+
+
+// A bvh_tree over a list of hittables, itself a hittable, so hierarchies nest.
 class bvh_node : public hittable  {
     public:
         bvh_node();
 
-        bvh_node(const hittable_list& list, double time0, double time1)
-            : bvh_node(list.objects, 0, list.objects.size(), time0, time1)
+        bvh_node(const hittable_list& list, double time0, double time1,
+                 const bvh_build_settings& settings = default_bvh_settings())
+            : bvh_node(list.objects, 0, list.objects.size(), time0, time1, settings)
         {}
 
         bvh_node(
             const std::vector<shared_ptr<hittable>>& src_objects,
-            size_t start, size_t end, double time0, double time1);
+            size_t start, size_t end, double time0, double time1,
+            const bvh_build_settings& settings = default_bvh_settings());
 
         virtual bool hit(
             const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
 
+        virtual uint32_t hit_packet(const ray_packet& rays, uint32_t active, double t_min,
+                                    double* t_max, hit_record* const* rec) const override;
+
+        virtual uint32_t occluded_packet(const ray_packet& rays, uint32_t active, double t_min,
+                                         const double* t_max) const override;
+
     public:
-        shared_ptr<hittable> left;
-        shared_ptr<hittable> right;
-        aabb box;
+        bvh_tree tree;
+        std::vector<shared_ptr<hittable>> primitives;   // in leaf order
+
+    private:
+        static constexpr int max_depth = bvh_tree::max_depth;
+
+        bool hit_leaf(uint32_t first, uint32_t count, const ray& r, double t_min, double t_max,
+                      hit_record& rec) const;
+
+        // hit_leaf() as a bvh_tree leaf callback, writing the closest hit to rec.
+        auto leaf_hitter(const ray& r, double t_min, hit_record& rec) const {
+            return [this, &r, t_min, &rec](uint32_t first, uint32_t count, double& t_max) {
+                if (!hit_leaf(first, count, r, t_min, t_max, rec))
+                    return false;
+                t_max = rec.t;
+                return true;
+            };
+        }
+
+        // occluded() over a leaf as a bvh_tree leaf callback.
+        auto leaf_occluder(const ray& r, double t_min, double t_max) const {
+            return [this, &r, t_min, t_max](uint32_t first, uint32_t count) {
+                for (auto i = first; i < first + count; i++)
+                    if (primitives[i]->occluded(r, t_min, t_max))
+                        return true;
+                return false;
+            };
+        }
+
+        uint32_t hit_packet_binary(const ray_packet& rays, uint32_t active, double t_min,
+                                   double* t_max, hit_record* const* rec) const;
+        template <int W>
+        uint32_t hit_packet_wide(const std::vector<bvh_wide_node<W>>& wide, const ray_packet& rays,
+                                 uint32_t active, double t_min, double* t_max,
+                                 hit_record* const* rec) const;
+
+        uint32_t occluded_packet_binary(const ray_packet& rays, uint32_t active, double t_min,
+                                        const double* t_max) const;
+        template <int W>
+        uint32_t occluded_packet_wide(const std::vector<bvh_wide_node<W>>& wide,
+                                      const ray_packet& rays, uint32_t active, double t_min,
+                                      const double* t_max) const;
 };
 
 
-inline bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis) {
-    aabb box_a;
-    aabb box_b;
+template <typename Bounds>
+void bvh_tree::build(uint32_t n, const bvh_build_settings& settings, Bounds bounds_of,
+                     std::vector<uint32_t>& order) {
+    auto build_start = std::chrono::steady_clock::now();
 
-    if (!a->bounding_box(0,0, box_a) || !b->bounding_box(0,0, box_b))
-        std::cerr << "No bounding box in bvh_node constructor.\n";
+    build_context ctx;
+    ctx.settings = settings;
+    ctx.settings.max_leaf_size = std::min(std::max(settings.max_leaf_size, 1), 255);
+    ctx.settings.bins = std::max(settings.bins, 2);
+    ctx.settings.num_threads = settings.num_threads > 0 ? settings.num_threads
+                             : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    ctx.settings.parallel_threshold = std::max(settings.parallel_threshold, 2u);
+    ctx.settings.width = settings.width == 4 || settings.width == 8 ? settings.width : 2;
+    ctx.idle_threads = ctx.settings.num_threads - 1;
 
-    return box_a.min().e[axis] < box_b.min().e[axis];
-}
+    ctx.prims.resize(n);
+    for_each_chunk(ctx, 0, n, [&](uint32_t chunk_begin, uint32_t chunk_end, int) {
+        for (auto i = chunk_begin; i < chunk_end; i++) {
+            auto& prim = ctx.prims[i];
+            if (!bounds_of(i, prim.bounds))
+                std::cerr << "No bounding box in bvh_node constructor.\n";
+            prim.centroid = prim.bounds.centroid();
+            prim.index = i;
+        }
+    });
 
+    nodes.reserve(2 * n);
+    if (n > 0) {
+        build_scratch scratch(ctx.settings.bins);
+        box = build_subtree(ctx, scratch, 0, n, 0, nodes);
+    }
 
-bool box_x_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-    return box_compare(a, b, 0);
-}
+    order.resize(n);
+    for (uint32_t i = 0; i < n; i++)
+        order[i] = ctx.prims[i].index;
 
-bool box_y_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-    return box_compare(a, b, 1);
-}
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - build_start;
+    stats.seconds = elapsed.count();
+    stats.threads = ctx.settings.num_threads;
+    compute_stats(ctx.settings);
+
+    width = ctx.settings.width;
+    if (width == 4 && !nodes.empty()) {
+        nodes4.reserve(nodes.size() / 2 + 1);
+        collapse(nodes4, 0);
+    } else if (width == 8 && !nodes.empty()) {
+        nodes8.reserve(nodes.size() / 4 + 1);
+        collapse(nodes8, 0);
+    } else {
+        width = 2;
+    }
+    auto node_count = width == 4 ? nodes4.size() : width == 8 ? nodes8.size() : nodes.size();
+    if (width != 2)
+        std::vector<bvh_flat_node>().swap(nodes);
 
-bool box_z_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-    return box_compare(a, b, 2);
+    if (!settings.report)
+        return;
+    std::cerr << "BVH over " << n << " primitives: " << node_count << " nodes, SAH cost "
+              << stats.sah_cost << ", built in " << stats.seconds << "s on " << stats.threads
+              << (stats.threads == 1 ? " thread\n" : " threads\n");
 }
 
 
 bvh_node::bvh_node(
     const std::vector<shared_ptr<hittable>>& src_objects,
-    size_t start, size_t end, double time0, double time1
+    size_t start, size_t end, double time0, double time1, const bvh_build_settings& settings
 ) {
-    auto objects = src_objects; // Create a modifiable array of the source scene objects
+    std::vector<uint32_t> order;
+    tree.build(static_cast<uint32_t>(end - start), settings,
+        [&](uint32_t i, aabb& box) { return src_objects[start + i]->bounding_box(time0, time1, box); },
+        order);
+
+    primitives.reserve(order.size());
+    for (auto i : order)
+        primitives.push_back(src_objects[start + i]);
+}
+
+
+// Takes up to wanted threads from the idle pool and returns how many it got. They go back
+// by adding to idle_threads.
+int bvh_tree::borrow_threads(build_context& ctx, int wanted) {
+    int idle = ctx.idle_threads.load();
+    while (idle > 0) {
+        int take = std::min(idle, wanted);
+        if (ctx.idle_threads.compare_exchange_weak(idle, idle - take))
+            return take;
+    }
+    return 0;
+}
+
+
+// Splits [begin, end) into one chunk per thread it can borrow, plus one for the calling
+// thread, and runs fn(chunk_begin, chunk_end, chunk) on each concurrently. Ranges below
+// parallel_threshold run as a single chunk. Returns the number of chunks.
+template <typename F>
+int bvh_tree::for_each_chunk(build_context& ctx, uint32_t begin, uint32_t end, F fn) {
+    uint32_t count = end - begin;
+    int helpers = 0;
+    if (count >= 2 * ctx.settings.parallel_threshold)
+        helpers = borrow_threads(ctx, std::min({count / ctx.settings.parallel_threshold,
+                                                static_cast<uint32_t>(ctx.settings.num_threads),
+                                                static_cast<uint32_t>(max_chunks)}) - 1);
 
-    int axis = random_int(0,2);
-    auto comparator = (axis == 0) ? box_x_compare
-                    : (axis == 1) ? box_y_compare
-                                  : box_z_compare;
+    int chunks = helpers + 1;
+    std::vector<std::thread> threads;
+    for (int c = 1; c < chunks; c++)
+        threads.emplace_back(fn, begin + uint64_t(count) * c / chunks,
+                             begin + uint64_t(count) * (c+1) / chunks, c);
+    fn(begin, begin + count / chunks, 0);
+    for (auto& thread : threads)
+        thread.join();
+
+    ctx.idle_threads += helpers;
+    return chunks;
+}
 
-    size_t object_span = end - start;
 
-    if (object_span == 1) {
-        left = right = objects[start];
-    } else if (object_span == 2) {
-        if (comparator(objects[start], objects[start+1])) {
-            left = objects[start];
-            right = objects[start+1];
+// Appends the subtree over ctx.prims[begin, end) to out in depth-first order, with child
+// offsets relative to out, and returns its bounds. Each axis is cut into equal bins by
+// primitive centroid, and the split between bins that minimises
+//
+//     traversal_cost + intersection_cost * (area(L) * |L| + area(R) * |R|) / area(node)
+//
+// is taken, unless a leaf is cheaper and small enough.
+aabb bvh_tree::build_subtree(build_context& ctx, build_scratch& scratch, uint32_t begin,
+                             uint32_t end, int depth, std::vector<bvh_flat_node>& out) {
+    const auto& settings = ctx.settings;
+    const aabb empty(point3(infinity, infinity, infinity), point3(-infinity, -infinity, -infinity));
+
+    // Bounds of the node and of its centroids. Big nodes gather them in parallel chunks,
+    // which merge exactly in any order.
+    uint32_t count = end - begin;
+    aabb node_box = empty, centroid_box = empty;
+    auto bound_range = [&](uint32_t range_begin, uint32_t range_end, aabb& range_box, aabb& range_centroids) {
+        for (auto k = range_begin; k < range_end; k++) {
+            range_box.expand(ctx.prims[k].bounds);
+            range_centroids.expand(ctx.prims[k].centroid);
+        }
+    };
+    if (count < 2 * settings.parallel_threshold) {
+        bound_range(begin, end, node_box, centroid_box);
+    } else {
+        std::vector<aabb> partial(2 * max_chunks, empty);
+        int chunks = for_each_chunk(ctx, begin, end, [&](uint32_t chunk_begin, uint32_t chunk_end, int c) {
+            bound_range(chunk_begin, chunk_end, partial[2*c], partial[2*c + 1]);
+        });
+        for (int c = 0; c < chunks; c++) {
+            node_box.expand(partial[2*c]);
+            centroid_box.expand(partial[2*c + 1]);
+        }
+    }
+
+    auto index = static_cast<uint32_t>(out.size());
+    out.emplace_back();
+    out[index].set_bounds(node_box);
+
+    auto make_leaf = [&]() {
+        out[index].offset = begin;
+        out[index].count = static_cast<uint16_t>(count);
+        out[index].axis = 0;
+        return node_box;
+    };
+    if (count == 1)
+        return make_leaf();
+
+    // Bin every primitive along all three axes in one pass, then sweep each axis for the
+    // cheapest boundary.
+    auto& bins = scratch.bins;
+    auto& right_area = scratch.right_area;
+    auto& right_count = scratch.right_count;
+    const int num_bins = settings.bins;
+
+    auto extent = centroid_box.max() - centroid_box.min();
+    auto low = centroid_box.min();
+    vec3 scale;
+    for (int axis = 0; axis < 3; axis++)
+        scale[axis] = extent[axis] > 0.0 ? num_bins / extent[axis] : 0.0;
+    auto bin_of = [&](const build_primitive& prim, int axis) {
+        return std::min(static_cast<int>((prim.centroid[axis] - low[axis]) * scale[axis]), num_bins - 1);
+    };
+    auto bin_range = [&](uint32_t range_begin, uint32_t range_end, build_scratch& target) {
+        for (int axis = 0; axis < 3; axis++)
+            for (int b = 0; b < num_bins; b++)
+                target.bins[axis][b] = {empty, 0};
+        for (auto k = range_begin; k < range_end; k++) {
+            const auto& prim = ctx.prims[k];
+            for (int axis = 0; axis < 3; axis++) {
+                auto& bin = target.bins[axis][bin_of(prim, axis)];
+                bin.bounds.expand(prim.bounds);
+                bin.count++;
+            }
+        }
+    };
+
+    double best_cost = infinity;
+    int best_axis = -1, best_split = 0;
+
+    if (depth < max_sah_depth && extent.length_squared() > 0.0) {
+        if (count < 2 * settings.parallel_threshold) {
+            bin_range(begin, end, scratch);
         } else {
-            left = objects[start+1];
-            right = objects[start];
+            std::vector<build_scratch> partial(std::min(settings.num_threads, max_chunks), build_scratch(num_bins));
+            int chunks = for_each_chunk(ctx, begin, end, [&](uint32_t chunk_begin, uint32_t chunk_end, int c) {
+                bin_range(chunk_begin, chunk_end, partial[c]);
+            });
+            bins[0] = partial[0].bins[0];
+            bins[1] = partial[0].bins[1];
+            bins[2] = partial[0].bins[2];
+            for (int c = 1; c < chunks; c++) {
+                for (int axis = 0; axis < 3; axis++) {
+                    for (int b = 0; b < num_bins; b++) {
+                        bins[axis][b].bounds.expand(partial[c].bins[axis][b].bounds);
+                        bins[axis][b].count += partial[c].bins[axis][b].count;
+                    }
+                }
+            }
+        }
+    }
+
+    for (int axis = 0; axis < 3 && depth < max_sah_depth; axis++) {
+        if (!(extent[axis] > 0.0))
+            continue;
+
+        aabb right = empty;
+        uint32_t n_right = 0;
+        for (int b = num_bins - 1; b > 0; b--) {
+            right.expand(bins[axis][b].bounds);
+            n_right += bins[axis][b].count;
+            right_area[b] = n_right ? right.surface_area() : 0.0;
+            right_count[b] = n_right;
         }
+
+        aabb left = empty;
+        uint32_t n_left = 0;
+        for (int b = 0; b < num_bins - 1; b++) {
+            left.expand(bins[axis][b].bounds);
+            n_left += bins[axis][b].count;
+            if (n_left == 0 || right_count[b+1] == 0)
+                continue;
+            auto cost = left.surface_area() * n_left + right_area[b+1] * right_count[b+1];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = b;
+            }
+        }
+    }
+
+    uint32_t mid;
+    if (best_axis >= 0) {
+        best_cost = settings.traversal_cost
+                  + settings.intersection_cost * best_cost / node_box.surface_area();
+        if (count <= static_cast<uint32_t>(settings.max_leaf_size)
+                && settings.intersection_cost * count <= best_cost)
+            return make_leaf();
+
+        auto axis = best_axis;
+        auto split = std::partition(ctx.prims.begin() + begin, ctx.prims.begin() + end,
+            [&](const build_primitive& prim) { return bin_of(prim, axis) <= best_split; });
+        mid = static_cast<uint32_t>(split - ctx.prims.begin());
+        out[index].axis = static_cast<uint16_t>(axis);
     } else {
-        std::sort(objects.begin() + start, objects.begin() + end, comparator);
+        // Centroids all coincide, or the tree is already deep: split at the median of the
+        // widest axis so the remaining levels stay balanced.
+        if (count <= static_cast<uint32_t>(settings.max_leaf_size))
+            return make_leaf();
 
-        auto mid = start + object_span/2;
-        left = make_shared<bvh_node>(objects, start, mid, time0, time1);
-        right = make_shared<bvh_node>(objects, mid, end, time0, time1);
+        int axis = extent.x() > extent.y() ? (extent.x() > extent.z() ? 0 : 2)
+                                           : (extent.y() > extent.z() ? 1 : 2);
+        mid = begin + count / 2;
+        std::nth_element(ctx.prims.begin() + begin, ctx.prims.begin() + mid, ctx.prims.begin() + end,
+            [&](const build_primitive& a, const build_primitive& b) {
+                return a.centroid[axis] < b.centroid[axis]
+                    || (a.centroid[axis] == b.centroid[axis] && a.index < b.index);
+            });
+        out[index].axis = static_cast<uint16_t>(axis);
     }
+    out[index].count = 0;
 
-    aabb box_left, box_right;
+    // The right subtree goes to an idle thread when it is big enough to be worth one. It
+    // is built into its own array and spliced in after the left one, which gives the same
+    // layout as building it in place.
+    if (end - mid >= settings.parallel_threshold && borrow_threads(ctx, 1) == 1) {
+        std::vector<bvh_flat_node> right_nodes;
+        right_nodes.reserve(2 * (end - mid));
+        std::thread right_thread([&]() {
+            build_scratch right_scratch(num_bins);
+            build_subtree(ctx, right_scratch, mid, end, depth + 1, right_nodes);
+        });
+        build_subtree(ctx, scratch, begin, mid, depth + 1, out);
+        right_thread.join();
+        ctx.idle_threads += 1;
 
-    if (  !left->bounding_box (time0, time1, box_left)
-       || !right->bounding_box(time0, time1, box_right)
-    )
-        std::cerr << "No bounding box in bvh_node constructor.\n";
+        auto base = static_cast<uint32_t>(out.size());
+        out[index].offset = base;
+        for (auto node : right_nodes) {
+            if (node.count == 0)
+                node.offset += base;
+            out.push_back(node);
+        }
+    } else {
+        build_subtree(ctx, scratch, begin, mid, depth + 1, out);
+        out[index].offset = static_cast<uint32_t>(out.size());
+        build_subtree(ctx, scratch, mid, end, depth + 1, out);
+    }
 
-    box = surrounding_box(box_left, box_right);
+    return node_box;
+}
+
+
+// Fills in stats from the finished tree. A node's share of the cost is its cost weighted
+// by the chance that a ray through the root also passes through it, area(node)/area(root).
+void bvh_tree::compute_stats(const bvh_build_settings& settings) {
+    stats.sah_cost = 0.0;
+    stats.leaves = 0;
+    stats.depth = 0;
+    if (nodes.empty())
+        return;
+
+    auto root_area = nodes[0].bounds().surface_area();
+    std::vector<std::pair<uint32_t, int>> pending = {{0, 1}};
+    while (!pending.empty()) {
+        auto [index, depth] = pending.back();
+        pending.pop_back();
+        const auto& node = nodes[index];
+        auto weight = root_area > 0.0 ? node.bounds().surface_area() / root_area : 1.0;
+
+        stats.depth = std::max(stats.depth, depth);
+        if (node.count > 0) {
+            stats.leaves++;
+            stats.sah_cost += weight * settings.intersection_cost * node.count;
+        } else {
+            stats.sah_cost += weight * settings.traversal_cost;
+            pending.push_back({index + 1, depth + 1});
+            pending.push_back({node.offset, depth + 1});
+        }
+    }
+}
+
+
+// Builds the wide node for binary interior node index (or, at the root, for whatever the
+// binary root is) and, depth first, the ones below it. Returns its index in out. The
+// children are gathered by repeatedly opening the interior child with the largest surface
+// area, which is the one most rays would otherwise have to descend through.
+template <int W>
+uint32_t bvh_tree::collapse(std::vector<bvh_wide_node<W>>& out, uint32_t index) const {
+    uint32_t children[W];
+    int n = 0;
+    if (nodes[index].count > 0) {
+        children[n++] = index;
+    } else {
+        children[n++] = index + 1;
+        children[n++] = nodes[index].offset;
+    }
+
+    while (n < W) {
+        int open = -1;
+        double open_area = -1.0;
+        for (int i = 0; i < n; i++) {
+            const auto& node = nodes[children[i]];
+            if (node.count == 0 && node.bounds().surface_area() > open_area) {
+                open = i;
+                open_area = node.bounds().surface_area();
+            }
+        }
+        if (open < 0)
+            break;
+        auto opened = children[open];
+        children[open] = opened + 1;
+        children[n++] = nodes[opened].offset;
+    }
+
+    auto wide = static_cast<uint32_t>(out.size());
+    out.emplace_back();
+    out[wide].clear();
+    for (int i = 0; i < n; i++) {
+        const auto& node = nodes[children[i]];
+        auto target = node.count > 0 ? node.offset : collapse(out, children[i]);
+        out[wide].set_child(i, node, target);
+    }
+    return wide;
+}
+
+
+template <typename Leaf>
+bool bvh_tree::closest_hit(const ray& r, double t_min, double t_max, Leaf leaf) const {
+    switch (width) {
+        case 4:  return !nodes4.empty() && closest_hit_wide(nodes4, 0, r, t_min, t_max, leaf);
+        case 8:  return !nodes8.empty() && closest_hit_wide(nodes8, 0, r, t_min, t_max, leaf);
+        default: return !nodes.empty() && closest_hit_binary(0, r, t_min, t_max, leaf);
+    }
+}
+
+
+// Children a ray hits are pushed farthest first, so the nearest comes off the stack next,
+// and each entry remembers where the ray enters it: once something closer has been hit,
+// entries behind it are dropped without touching their nodes.
+template <int W, typename Leaf>
+bool bvh_tree::closest_hit_wide(const std::vector<bvh_wide_node<W>>& wide, uint32_t root,
+                                const ray& r, double t_min, double t_max, Leaf leaf) const {
+    const traversal_ray tr(r);
+
+    struct entry { uint32_t child; uint32_t count; double t; };
+    entry stack[max_depth * (W - 1) + 1];
+    int stack_size = 0;
+    stack[stack_size++] = {root, 0, t_min};
+
+    alignas(32) double t_entry[W];
+    bool hit_anything = false;
+
+    while (stack_size > 0) {
+        auto current = stack[--stack_size];
+        if (current.t >= t_max)
+            continue;
+
+        if (current.count > 0) {
+            if (leaf(current.child, current.count, t_max))
+                hit_anything = true;
+            continue;
+        }
+
+        const auto& node = wide[current.child];
+        auto hits = node.hit(tr, t_min, t_max, t_entry);
+        int first = stack_size;
+        for (; hits != 0; hits &= hits - 1) {
+            int i = lowest_lane(hits);
+            entry child{node.child[i], node.count[i], t_entry[i]};
+            int k = stack_size++;
+            for (; k > first && stack[k-1].t < child.t; k--)
+                stack[k] = stack[k-1];
+            stack[k] = child;
+        }
+    }
+
+    return hit_anything;
+}
+
+
+template <typename Leaf>
+bool bvh_tree::closest_hit_binary(int root, const ray& r, double t_min, double t_max, Leaf leaf) const {
+    const traversal_ray tr(r);
+
+    int stack[max_depth];
+    int stack_size = 0;
+    int index = root;
+    bool hit_anything = false;
+
+    for (;;) {
+        const auto& node = nodes[index];
+        if (node.hit(tr, t_min, t_max)) {
+            if (node.count == 0) {
+                // Visit the child on the side the ray comes from first, so the far child
+                // is usually culled by the closer hit.
+                int near_child = index + 1, far_child = node.offset;
+                if (tr.sign[node.axis])
+                    std::swap(near_child, far_child);
+                stack[stack_size++] = far_child;
+                index = near_child;
+                continue;
+            }
+
+            if (leaf(node.offset, node.count, t_max))
+                hit_anything = true;
+        }
+
+        if (stack_size == 0)
+            break;
+        index = stack[--stack_size];
+    }
+
+    return hit_anything;
+}
+
+
+template <typename Leaf>
+bool bvh_tree::any_hit(const ray& r, double t_min, double t_max, Leaf leaf) const {
+    switch (width) {
+        case 4:  return !nodes4.empty() && any_hit_wide(nodes4, 0, r, t_min, t_max, leaf);
+        case 8:  return !nodes8.empty() && any_hit_wide(nodes8, 0, r, t_min, t_max, leaf);
+        default: return !nodes.empty() && any_hit_binary(0, r, t_min, t_max, leaf);
+    }
+}
+
+
+// Any hit will do, so there is no closest hit to cull against and no point in ordering the
+// children: the first leaf that reports an intersection ends the traversal.
+template <int W, typename Leaf>
+bool bvh_tree::any_hit_wide(const std::vector<bvh_wide_node<W>>& wide, uint32_t root,
+                            const ray& r, double t_min, double t_max, Leaf leaf) const {
+    const traversal_ray tr(r);
+
+    struct entry { uint32_t child; uint32_t count; };
+    entry stack[max_depth * (W - 1) + 1];
+    int stack_size = 0;
+    stack[stack_size++] = {root, 0};
+
+    alignas(32) double t_entry[W];
+
+    while (stack_size > 0) {
+        auto current = stack[--stack_size];
+
+        if (current.count > 0) {
+            if (leaf(current.child, current.count))
+                return true;
+            continue;
+        }
+
+        const auto& node = wide[current.child];
+        for (auto hits = node.hit(tr, t_min, t_max, t_entry); hits != 0; hits &= hits - 1) {
+            int i = lowest_lane(hits);
+            stack[stack_size++] = {node.child[i], node.count[i]};
+        }
+    }
+
+    return false;
+}
+
+
+template <typename Leaf>
+bool bvh_tree::any_hit_binary(int root, const ray& r, double t_min, double t_max, Leaf leaf) const {
+    const traversal_ray tr(r);
+
+    int stack[max_depth];
+    int stack_size = 0;
+    int index = root;
+
+    for (;;) {
+        const auto& node = nodes[index];
+        if (node.hit(tr, t_min, t_max)) {
+            if (node.count == 0) {
+                stack[stack_size++] = node.offset;
+                index++;
+                continue;
+            }
+
+            if (leaf(node.offset, node.count))
+                return true;
+        }
+
+        if (stack_size == 0)
+            break;
+        index = stack[--stack_size];
+    }
+
+    return false;
 }
 
 
 bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    if (!box.hit(r, t_min, t_max))
-        return false;
+    return tree.closest_hit(r, t_min, t_max, leaf_hitter(r, t_min, rec));
+}
+
+
+bool bvh_node::hit_leaf(uint32_t first, uint32_t count, const ray& r, double t_min, double t_max,
+                        hit_record& rec) const {
+    bool hit_anything = false;
+    for (auto i = first; i < first + count; i++) {
+        if (primitives[i]->hit(r, t_min, t_max, rec)) {
+            hit_anything = true;
+            t_max = rec.t;
+        }
+    }
+    return hit_anything;
+}
+
+
+bool bvh_node::occluded(const ray& r, double t_min, double t_max) const {
+    return tree.any_hit(r, t_min, t_max, leaf_occluder(r, t_min, t_max));
+}
+
+
+uint32_t bvh_node::hit_packet(
+    const ray_packet& rays, uint32_t active, double t_min, double* t_max, hit_record* const* rec
+) const {
+    switch (tree.width) {
+        case 4:  return tree.nodes4.empty() ? 0 : hit_packet_wide(tree.nodes4, rays, active, t_min, t_max, rec);
+        case 8:  return tree.nodes8.empty() ? 0 : hit_packet_wide(tree.nodes8, rays, active, t_min, t_max, rec);
+        default: return tree.nodes.empty() ? 0 : hit_packet_binary(rays, active, t_min, t_max, rec);
+    }
+}
+
+
+// Each child is tested against the whole packet; the ones any lane hits are visited in the
+// order the packet's first live lane reaches them.
+template <int W>
+uint32_t bvh_node::hit_packet_wide(
+    const std::vector<bvh_wide_node<W>>& wide, const ray_packet& rays, uint32_t active,
+    double t_min, double* t_max, hit_record* const* rec
+) const {
+    if (active == 0)
+        return 0;
+
+    struct entry { uint32_t child; uint32_t count; uint32_t lanes; double t; };
+    entry stack[max_depth * (W - 1) + 1];
+    int stack_size = 0;
+    stack[stack_size++] = {0, 0, active, 0.0};
+
+    alignas(32) double t_entry[W];
+    uint32_t hits = 0;
+
+    while (stack_size > 0) {
+        auto current = stack[--stack_size];
+        auto lanes = current.lanes;
+
+        if ((lanes & (lanes - 1)) == 0) {
+            // A packet that has thinned out to one ray is cheaper to finish as a single ray.
+            int l = lowest_lane(lanes);
+            auto r = rays.get(l);
+            bool hit = current.count > 0
+                ? hit_leaf(current.child, current.count, r, t_min, t_max[l], *rec[l])
+                : tree.closest_hit_wide(wide, current.child, r, t_min, t_max[l],
+                                        leaf_hitter(r, t_min, *rec[l]));
+            if (hit) {
+                t_max[l] = rec[l]->t;
+                hits |= lanes;
+            }
+            continue;
+        }
+
+        if (current.count > 0) {
+            for (auto i = current.child; i < current.child + current.count; i++)
+                hits |= primitives[i]->hit_packet(rays, lanes, t_min, t_max, rec);
+            continue;
+        }
+
+        const auto& node = wide[current.child];
+        int l = lowest_lane(lanes);
+        node.hit(traversal_ray(rays.get(l)), t_min, infinity, t_entry);
+
+        int first = stack_size;
+        for (int i = 0; i < W; i++) {
+            auto child_lanes = node.bounds(i).hit_packet(rays, lanes, t_min, t_max);
+            if (child_lanes == 0)
+                continue;
+            entry child{node.child[i], node.count[i], child_lanes, t_entry[i]};
+            int k = stack_size++;
+            for (; k > first && stack[k-1].t < child.t; k--)
+                stack[k] = stack[k-1];
+            stack[k] = child;
+        }
+    }
+
+    return hits;
+}
+
+
+uint32_t bvh_node::hit_packet_binary(
+    const ray_packet& rays, uint32_t active, double t_min, double* t_max, hit_record* const* rec
+) const {
+    struct entry { int index; uint32_t lanes; };
+    entry stack[max_depth];
+    int stack_size = 0;
+    entry current{0, active};
+    uint32_t hits = 0;
+
+    for (;;) {
+        const auto& node = tree.nodes[current.index];
+        uint32_t lanes = node.bounds().hit_packet(rays, current.lanes, t_min, t_max);
 
-    bool hit_left = left->hit(r, t_min, t_max, rec);
-    bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
+        if ((lanes & (lanes - 1)) == 0 && lanes != 0) {
+            // A packet that has thinned out to one ray is cheaper to finish as a single ray.
+            int l = lowest_lane(lanes);
+            auto r = rays.get(l);
+            if (tree.closest_hit_binary(current.index, r, t_min, t_max[l], leaf_hitter(r, t_min, *rec[l]))) {
+                t_max[l] = rec[l]->t;
+                hits |= lanes;
+            }
+        } else if (lanes != 0) {
+            if (node.count == 0) {
+                int near_child = current.index + 1, far_child = node.offset;
+                const double* dir = node.axis == 0 ? rays.dx : node.axis == 1 ? rays.dy : rays.dz;
+                if (dir[lowest_lane(lanes)] < 0)
+                    std::swap(near_child, far_child);
+                stack[stack_size++] = {far_child, lanes};
+                current = {near_child, lanes};
+                continue;
+            }
+
+            for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+                hits |= primitives[i]->hit_packet(rays, lanes, t_min, t_max, rec);
+        }
+
+        if (stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+
+    return hits;
+}
+
+
+uint32_t bvh_node::occluded_packet(
+    const ray_packet& rays, uint32_t active, double t_min, const double* t_max
+) const {
+    switch (tree.width) {
+        case 4:  return tree.nodes4.empty() ? 0 : occluded_packet_wide(tree.nodes4, rays, active, t_min, t_max);
+        case 8:  return tree.nodes8.empty() ? 0 : occluded_packet_wide(tree.nodes8, rays, active, t_min, t_max);
+        default: return tree.nodes.empty() ? 0 : occluded_packet_binary(rays, active, t_min, t_max);
+    }
+}
+
+
+// As any_hit_wide(), with each entry carrying the lanes that reached it. A lane that is
+// blocked is dropped from every entry still on the stack, and a lane left on its own
+// finishes the subtree as a single ray.
+template <int W>
+uint32_t bvh_node::occluded_packet_wide(
+    const std::vector<bvh_wide_node<W>>& wide, const ray_packet& rays, uint32_t active,
+    double t_min, const double* t_max
+) const {
+    struct entry { uint32_t child; uint32_t count; uint32_t lanes; };
+    entry stack[max_depth * (W - 1) + 1];
+    int stack_size = 0;
+    stack[stack_size++] = {0, 0, active};
+
+    uint32_t blocked = 0;
+
+    while (stack_size > 0 && blocked != active) {
+        auto current = stack[--stack_size];
+        auto lanes = current.lanes & ~blocked;
+        if (lanes == 0)
+            continue;
+
+        if ((lanes & (lanes - 1)) == 0) {
+            int l = lowest_lane(lanes);
+            auto r = rays.get(l);
+            auto leaf = leaf_occluder(r, t_min, t_max[l]);
+            if (current.count > 0 ? leaf(current.child, current.count)
+                                  : tree.any_hit_wide(wide, current.child, r, t_min, t_max[l], leaf))
+                blocked |= lanes;
+            continue;
+        }
+
+        if (current.count > 0) {
+            for (auto i = current.child; i < current.child + current.count && lanes; i++) {
+                blocked |= primitives[i]->occluded_packet(rays, lanes, t_min, t_max);
+                lanes &= ~blocked;
+            }
+            continue;
+        }
+
+        const auto& node = wide[current.child];
+        for (int i = 0; i < W; i++) {
+            auto child_lanes = node.bounds(i).hit_packet(rays, lanes, t_min, t_max);
+            if (child_lanes != 0)
+                stack[stack_size++] = {node.child[i], node.count[i], child_lanes};
+        }
+    }
+
+    return blocked;
+}
+
+
+uint32_t bvh_node::occluded_packet_binary(
+    const ray_packet& rays, uint32_t active, double t_min, const double* t_max
+) const {
+    struct entry { int index; uint32_t lanes; };
+    entry stack[max_depth];
+    int stack_size = 0;
+    entry current{0, active};
+    uint32_t blocked = 0;
+
+    for (;;) {
+        const auto& node = tree.nodes[current.index];
+        uint32_t lanes = node.bounds().hit_packet(rays, current.lanes & ~blocked, t_min, t_max);
+
+        if ((lanes & (lanes - 1)) == 0 && lanes != 0) {
+            int l = lowest_lane(lanes);
+            auto r = rays.get(l);
+            if (tree.any_hit_binary(current.index, r, t_min, t_max[l], leaf_occluder(r, t_min, t_max[l])))
+                blocked |= lanes;
+        } else if (lanes != 0) {
+            if (node.count == 0) {
+                stack[stack_size++] = {static_cast<int>(node.offset), lanes};
+                current = {current.index + 1, lanes};
+                continue;
+            }
+
+            for (uint32_t i = node.offset; i < node.offset + node.count && lanes; i++) {
+                blocked |= primitives[i]->occluded_packet(rays, lanes, t_min, t_max);
+                lanes &= ~blocked;
+            }
+        }
+
+        if (stack_size == 0 || blocked == active)
+            break;
+        current = stack[--stack_size];
+    }
 
-    return hit_left || hit_right;
+    return blocked;
 }
 
 
 bool bvh_node::bounding_box(double time0, double time1, aabb& output_box) const {
-    output_box = box;
+    output_box = tree.box;
     return true;
 }
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,152 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "film.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+// On-disk accumulation state of a render, or of one window of it: a small header followed
+// by the film's raw arrays. The header also records how long the render has taken over all
+// its runs and the precision it was built with, which is what --compare reports its time
+// ratio against, and a hash of the render settings, so a render is only ever resumed with
+// the settings its samples were taken with. Because the per-pixel sampler is counter
+// based, a pixel's RNG stream position is simply its sample count, so resuming continues
+// each pixel's stream at sample index counts[p] and never repeats a sample.
+struct checkpoint_header {
+    char magic[4];
+    uint32_t version;
+    int32_t width, height;
+    int32_t x0, y0;
+    uint64_t seed;
+    uint64_t settings_hash; // see checkpoint_settings_hash()
+    double render_seconds;
+    int32_t real_bits;      // 32 for a float build, 64 for double
+};
+
+const uint32_t checkpoint_version = 4;
+
+// What load_checkpoint() found. A file that exists but is truncated, corrupt or from
+// another checkpoint version is invalid, not missing, so it is never silently replaced.
+enum class checkpoint_status { loaded, missing, invalid };
+
+// FNV-1a of the settings text a render was started with (see main.cpp).
+inline uint64_t checkpoint_settings_hash(const std::string& settings) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (unsigned char c : settings) {
+        hash ^= c;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+inline bool save_checkpoint(const char* filename, const film& image, uint64_t seed,
+                            uint64_t settings_hash, double render_seconds = 0) {
+    // Write to a temporary file and rename it over the old checkpoint, so a job killed
+    // mid-write still leaves the previous checkpoint intact.
+    auto temp_name = std::string(filename) + ".tmp";
+    FILE* f = fopen(temp_name.c_str(), "wb");
+    if (!f) return false;
+
+    checkpoint_header header{};
+    memcpy(header.magic, "RTCK", 4);
+    header.version = checkpoint_version;
+    header.width = image.width;
+    header.height = image.height;
+    header.x0 = image.x0;
+    header.y0 = image.y0;
+    header.seed = seed;
+    header.settings_hash = settings_hash;
+    header.render_seconds = render_seconds;
+    header.real_bits = 8 * sizeof(real);
+
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+           && fwrite(image.sums.data(), sizeof(float), image.sums.size(), f) == image.sums.size()
+           && fwrite(image.counts.data(), sizeof(uint32_t), image.counts.size(), f) == image.counts.size()
+           && fwrite(image.luminance_m2.data(), sizeof(float), image.luminance_m2.size(), f) == image.luminance_m2.size();
+    ok = (fclose(f) == 0) && ok;
+
+    return ok && rename(temp_name.c_str(), filename) == 0;
+}
+
+// Loads a checkpoint into image and seed, and its whole header into the optional
+// argument. Leaves everything untouched unless the checkpoint is loaded.
+inline checkpoint_status load_checkpoint(const char* filename, film& image, uint64_t& seed,
+                                         checkpoint_header* header_out = nullptr) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) return errno == ENOENT ? checkpoint_status::missing : checkpoint_status::invalid;
+
+    checkpoint_header header;
+    bool ok = fread(&header, sizeof(header), 1, f) == 1
+           && memcmp(header.magic, "RTCK", 4) == 0
+           && header.version == checkpoint_version
+           && header.width > 0 && header.height > 0;
+
+    film loaded;
+    if (ok) {
+        loaded = film(header.width, header.height, header.x0, header.y0);
+        ok = fread(loaded.sums.data(), sizeof(float), loaded.sums.size(), f) == loaded.sums.size()
+          && fread(loaded.counts.data(), sizeof(uint32_t), loaded.counts.size(), f) == loaded.counts.size()
+          && fread(loaded.luminance_m2.data(), sizeof(float), loaded.luminance_m2.size(), f) == loaded.luminance_m2.size();
+    }
+    fclose(f);
+
+    if (!ok) return checkpoint_status::invalid;
+    image = std::move(loaded);
+    seed = header.seed;
+    if (header_out) *header_out = header;
+    return checkpoint_status::loaded;
+}
+
+// Writes the film to a checkpoint file at most once per interval. Render threads call
+// update() after committing a tile; whichever thread finds the interval elapsed takes the
+// snapshot while holding the film lock, so no half-committed tile reaches the file.
+class checkpointer {
+    public:
+        // earlier_seconds is the render time of the runs before this one.
+        checkpointer(const char* filename, double interval_seconds, uint64_t seed,
+                     uint64_t settings_hash, double earlier_seconds = 0)
+            : path(filename), interval(interval_seconds), render_seed(seed),
+              render_settings(settings_hash), previous_seconds(earlier_seconds), start(std::chrono::steady_clock::now()),
+              last_save(start) {}
+
+        // Render time so far, counting earlier runs.
+        double render_seconds() const {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            return previous_seconds + elapsed.count();
+        }
+
+        void update(const film& image, std::mutex& film_lock) {
+            if (path.empty() || interval <= 0) return;
+
+            film snapshot;
+            {
+                std::lock_guard<std::mutex> guard(film_lock);
+                auto now = std::chrono::steady_clock::now();
+                if (std::chrono::duration<double>(now - last_save).count() < interval)
+                    return;
+                last_save = now;
+                snapshot = image;
+            }
+
+            std::lock_guard<std::mutex> guard(write_lock);
+            if (!save_checkpoint(path.c_str(), snapshot, render_seed, render_settings, render_seconds()))
+                std::cerr << "\nERROR: Could not write checkpoint '" << path << "'.\n";
+        }
+
+    private:
+        std::string path;
+        double interval;
+        uint64_t render_seed;
+        uint64_t render_settings;
+        double previous_seconds;
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::time_point last_save;
+        std::mutex write_lock;
+};
+
+#endif
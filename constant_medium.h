@@ -9,10 +9,10 @@
 
 class constant_medium : public hittable {
     public:
-        constant_medium(shared_ptr<hittable> b, double d, shared_ptr<texture> a)
-            : boundary(b), neg_inv_density(-1/d), phase_function(make_shared<isotropic>(a)) {}
-        constant_medium(shared_ptr<hittable> b, double d, color c)
-            : boundary(b), neg_inv_density(-1/d), phase_function(make_shared<isotropic>(c)) {}
+        // phase is normally an isotropic material from the scene's material_table, and
+        // stream one the scene hands out (see scene::next_medium_stream()).
+        constant_medium(shared_ptr<hittable> b, double d, const material* phase, uint32_t stream)
+            : boundary(b), phase_function(phase), neg_inv_density(-1/d), stream(stream) {}
 
         virtual bool hit(
             const ray& r, double t_min, double t_max, hit_record& rec) const override;
@@ -22,14 +22,29 @@ class constant_medium : public hittable {
         }
     public:
         shared_ptr<hittable> boundary;
-        shared_ptr<material> phase_function;
+        const material* phase_function;
         double neg_inv_density;
+
+    private:
+        // Each medium draws its free-flight distances from its own stream of the path's
+        // sampler, at the dimension the integrator reserved for the ray, so two media on one
+        // ray decide independently and the same medium gives the same distance every time
+        // the ray is tested.
+        uint32_t stream;
+
+        // Rays that aren't part of a path, like --bench's, fall back to the thread's
+        // generator.
+        double free_flight_sample(const ray& r) const {
+            if (!r.medium_rng)
+                return random_double();
+            return r.medium_rng->random_double_at(r.medium_dimension, stream);
+        }
 };
 
 
 bool constant_medium::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
     const bool enable_debug = false;
-    const bool debugging = enable_debug && random_double() < 0.00001;
+    const bool debugging = enable_debug;
 
     hit_record rec1, rec2;
 
@@ -42,7 +57,7 @@ bool constant_medium::hit(const ray& r, double t_min, double t_max, hit_record&
 
     if (debugging) std::cerr << "\nt_min=" << rec1.t << ", t_max=" << rec2.t << '\n';
 
-        if (rec1.t < t_min) rec1.t = t_min;
+    if (rec1.t < t_min) rec1.t = t_min;
     if (rec2.t > t_max) rec2.t = t_max;
 
     if (rec1.t >= rec2.t)
@@ -53,7 +68,7 @@ bool constant_medium::hit(const ray& r, double t_min, double t_max, hit_record&
 
     const auto ray_length = r.direction().length();
     const auto distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
-    const auto hit_distance = neg_inv_density * log(random_double());
+    const auto hit_distance = neg_inv_density * log(1.0 - free_flight_sample(r));
 
     if (hit_distance > distance_inside_boundary)
         return false;
@@ -0,0 +1,73 @@
+#ifndef DIRECT_LIGHT_H
+#define DIRECT_LIGHT_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "material.h"
+
+// Explicit light sampling (next event estimation). At every hit on a material that
+// importance samples (skip_pdf() is false) the integrators pick a point on the scene's
+// lights and, unless world.occluded() finds something in the way, add the light it sends
+// straight back. The path then carries on in the direction the material sampled, so a
+// light can be found both ways; the balance heuristic weights each estimate by its own pdf
+// over the sum of both, which keeps the total unbiased and lets whichever strategy is less
+// noisy for a given direction dominate.
+//
+// Light samples are evaluated on scene::lights itself, so the objects in it must be the
+// ones in the world, with the material and facing they are rendered with.
+
+// Hits closer than this fraction of the distance to the sampled point count as occluding
+// it; the rest keeps the light from shadowing its own sample.
+constexpr double shadow_ray_scale = 1 - 1e-6;
+
+// A light sample taken from a hit, and what it contributes if the shadow ray is clear.
+struct light_sample {
+    ray shadow;
+    double t_max;       // of the shadow ray, just short of the light
+    color radiance;     // light reaching the hit, times the bsdf and the MIS weight
+};
+
+// Samples lights as seen from rec. r_in is the ray that hit rec and albedo what its
+// material's scatter() returned. Returns false if the sample can't contribute, in which
+// case there is no shadow ray to trace.
+inline bool sample_light(const hittable& lights, const ray& r_in, const hit_record& rec,
+                         const color& albedo, sampler& rng, light_sample& sample) {
+    sample.shadow = ray(rec.p, lights.random(rec.p, rng), r_in.time());
+    sample.shadow.sample_media(rng);
+
+    auto light_pdf = lights.pdf_value(rec.p, sample.shadow.direction());
+    if (light_pdf <= 0)
+        return false;
+
+    // Materials that importance sample draw directions from scattering_pdf() itself, so
+    // it is also the pdf the path would have found this direction with.
+    auto scattering_pdf = rec.mat_ptr->scattering_pdf(r_in, rec, sample.shadow);
+    if (scattering_pdf <= 0)
+        return false;
+
+    hit_record light_rec;
+    if (!lights.hit(sample.shadow, 0.001, infinity, light_rec) || !light_rec.mat_ptr)
+        return false;
+    auto emitted = light_rec.mat_ptr->emitted(sample.shadow, light_rec, light_rec.u, light_rec.v,
+                                              light_rec.p);
+
+    sample.t_max = light_rec.t * shadow_ray_scale;
+    sample.radiance = albedo * scattering_pdf * emitted / (light_pdf + scattering_pdf);
+    return true;
+}
+
+// Emission at rec, found by r. bsdf_pdf is the pdf the previous bounce sampled r with if
+// that bounce also took a light sample, and 0 otherwise (camera rays, specular bounces,
+// scenes without lights), in which case the emission counts in full.
+inline color weighted_emission(const hittable* lights, const ray& r, const hit_record& rec,
+                               double bsdf_pdf) {
+    auto emitted = rec.mat_ptr->emitted(r, rec, rec.u, rec.v, rec.p);
+    if (bsdf_pdf > 0 && (emitted.x() != 0 || emitted.y() != 0 || emitted.z() != 0)) {
+        auto light_pdf = lights->pdf_value(r.origin(), r.direction());
+        emitted = emitted * (bsdf_pdf / (bsdf_pdf + light_pdf));
+    }
+    return emitted;
+}
+
+#endif
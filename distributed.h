@@ -0,0 +1,269 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "checkpoint.h"
+#include "film.h"
+#include "tile_scheduler.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Multi-process rendering through a shared job directory. The coordinator cuts the image
+// into job tiles and writes one file per job into todo/. Workers, which may be local child
+// processes or processes on other machines mounting the same directory, claim a job by
+// renaming its file into claimed/ (rename is atomic, so each job goes to exactly one
+// worker), render it, and save the resulting film window into done/. The coordinator then
+// merges the windows into the final film. A worker builds its scene and BVH once and then
+// keeps claiming jobs until todo/ is empty.
+//
+//     <dir>/settings            render parameters every worker must agree with
+//     <dir>/todo/<id>           "x0 y0 x1 y1" of an unclaimed job
+//     <dir>/claimed/<id>.<pid>  a job some worker is rendering
+//     <dir>/done/<id>.ckpt      the finished window, in checkpoint format
+
+struct render_job {
+    int id;
+    tile region;
+};
+
+class job_directory {
+    public:
+        job_directory(const std::string& dir) : root(dir) {}
+
+        // Creates a fresh job directory holding one job per job_size x job_size tile. Any
+        // jobs or results left over from an earlier render are removed.
+        bool create(int image_width, int image_height, int job_size, const std::string& settings) {
+            for (auto state : {"todo", "claimed", "done"}) {
+                if (!make_dir(root) || !make_dir(root + "/" + state))
+                    return false;
+                for (auto& name : list_dir(root + "/" + state))
+                    unlink((root + "/" + state + "/" + name).c_str());
+            }
+
+            if (!write_file(root + "/settings", settings))
+                return false;
+
+            int id = 0;
+            for (int y1 = image_height; y1 > 0; y1 -= job_size) {
+                for (int x0 = 0; x0 < image_width; x0 += job_size) {
+                    tile t{x0, std::max(y1 - job_size, 0), std::min(x0 + job_size, image_width), y1};
+                    char line[64];
+                    snprintf(line, sizeof(line), "%d %d %d %d\n", t.x0, t.y0, t.x1, t.y1);
+                    if (!write_file(job_path("todo", id), line))
+                        return false;
+                    id++;
+                }
+            }
+
+            job_count = id;
+            return true;
+        }
+
+        int jobs() const { return job_count; }
+
+        std::string read_settings() const {
+            std::string settings;
+            read_file(root + "/settings", settings);
+            return settings;
+        }
+
+        // Takes ownership of one unclaimed job. Returns false once there is nothing left.
+        bool claim(render_job& job) {
+            for (auto& name : list_dir(root + "/todo")) {
+                auto claimed = claimed_path(name);
+                if (rename((root + "/todo/" + name).c_str(), claimed.c_str()) != 0)
+                    continue; // another worker got there first
+
+                std::string line;
+                if (read_file(claimed, line)
+                    && sscanf(line.c_str(), "%d %d %d %d", &job.region.x0, &job.region.y0,
+                              &job.region.x1, &job.region.y1) == 4) {
+                    job.id = std::stoi(name);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool complete(const render_job& job, const film& window, uint64_t seed, uint64_t settings_hash) {
+            if (!save_checkpoint(job_path("done", job.id).append(".ckpt").c_str(), window, seed, settings_hash))
+                return false;
+            unlink(claimed_path(job_name(job.id)).c_str());
+            return true;
+        }
+
+        int completed() const {
+            return static_cast<int>(list_dir(root + "/done", ".ckpt").size());
+        }
+
+        // Moves jobs claimed by workers that died before finishing back into todo/.
+        int requeue_abandoned() {
+            int requeued = 0;
+            for (auto& name : list_dir(root + "/claimed")) {
+                auto id = name.substr(0, name.find('.'));
+                if (rename((root + "/claimed/" + name).c_str(), (root + "/todo/" + id).c_str()) == 0)
+                    requeued++;
+            }
+            return requeued;
+        }
+
+        // Adds every finished window into image.
+        bool merge_into(film& image) const {
+            for (int id = 0; id < job_count; id++) {
+                film window;
+                uint64_t seed;
+                if (load_checkpoint(job_path("done", id).append(".ckpt").c_str(), window, seed)
+                        != checkpoint_status::loaded
+                    || !image.merge(window))
+                    return false;
+            }
+            return true;
+        }
+
+    private:
+        std::string root;
+        int job_count = 0;
+
+        static std::string job_name(int id) {
+            char name[16];
+            snprintf(name, sizeof(name), "%06d", id);
+            return name;
+        }
+
+        std::string job_path(const char* state, int id) const {
+            return root + "/" + state + "/" + job_name(id);
+        }
+
+        std::string claimed_path(const std::string& name) const {
+            return root + "/claimed/" + name + "." + std::to_string(getpid());
+        }
+
+        static bool make_dir(const std::string& path) {
+            return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+        }
+
+        static bool write_file(const std::string& path, const std::string& contents) {
+            auto temp = path + ".tmp";
+            FILE* f = fopen(temp.c_str(), "w");
+            if (!f) return false;
+            bool ok = fwrite(contents.data(), 1, contents.size(), f) == contents.size();
+            ok = (fclose(f) == 0) && ok;
+            return ok && rename(temp.c_str(), path.c_str()) == 0;
+        }
+
+        static bool read_file(const std::string& path, std::string& contents) {
+            FILE* f = fopen(path.c_str(), "r");
+            if (!f) return false;
+            char buffer[256];
+            contents.clear();
+            size_t n;
+            while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+                contents.append(buffer, n);
+            fclose(f);
+            return true;
+        }
+
+        // Sorted entry names in a directory, skipping temporaries and anything without the
+        // given suffix.
+        static std::vector<std::string> list_dir(const std::string& path, const std::string& suffix = "") {
+            std::vector<std::string> names;
+            DIR* d = opendir(path.c_str());
+            if (!d) return names;
+            while (auto entry = readdir(d)) {
+                std::string name = entry->d_name;
+                if (name[0] == '.' || name.find(".tmp") != std::string::npos) continue;
+                if (name.size() < suffix.size()
+                    || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
+                    continue;
+                names.push_back(name);
+            }
+            closedir(d);
+            std::sort(names.begin(), names.end());
+            return names;
+        }
+};
+
+// Worker side: claims and renders jobs until none are left. render_window fills a film
+// covering the job's region.
+inline int run_worker(const std::string& dir, const std::string& settings, uint64_t seed,
+                      const std::function<void(const tile&, film&)>& render_window) {
+    job_directory jobs(dir);
+    if (jobs.read_settings() != settings) {
+        std::cerr << "ERROR: Worker settings do not match job directory '" << dir << "'.\n";
+        return 1;
+    }
+
+    render_job job;
+    while (jobs.claim(job)) {
+        film window(job.region.x1 - job.region.x0, job.region.y1 - job.region.y0,
+                    job.region.x0, job.region.y0);
+        render_window(job.region, window);
+        if (!jobs.complete(job, window, seed, checkpoint_settings_hash(settings))) {
+            std::cerr << "ERROR: Could not save job " << job.id << ".\n";
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Coordinator side: creates the job directory, runs num_workers copies of worker_argv as
+// child processes until every job is done (restarting workers for jobs abandoned by a
+// crashed one), and merges the results into image.
+inline bool run_coordinator(const std::string& dir, int num_workers, int job_size,
+                            const std::string& settings, const std::vector<std::string>& worker_argv,
+                            film& image) {
+    job_directory jobs(dir);
+    if (!jobs.create(image.width, image.height, job_size, settings)) {
+        std::cerr << "ERROR: Could not create job directory '" << dir << "'.\n";
+        return false;
+    }
+
+    const int max_rounds = 3;
+    for (int round = 0; round < max_rounds && jobs.completed() < jobs.jobs(); round++) {
+        std::vector<pid_t> children;
+        for (int w = 0; w < num_workers; w++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                std::vector<char*> args;
+                for (auto& a : worker_argv) args.push_back(const_cast<char*>(a.c_str()));
+                args.push_back(nullptr);
+                execvp(args[0], args.data());
+                _exit(127);
+            }
+            if (pid > 0) children.push_back(pid);
+        }
+
+        while (!children.empty()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            children.erase(std::remove_if(children.begin(), children.end(), [](pid_t pid) {
+                return waitpid(pid, nullptr, WNOHANG) == pid;
+            }), children.end());
+
+            int remaining = jobs.jobs() - jobs.completed();
+            int percent_left = static_cast<int>(100*((float)remaining/(float)jobs.jobs()));
+            std::cerr << "\rJobs Remaining: " << remaining << " | " << percent_left << "\% left"
+                      << " | Workers: " << children.size() << " | " << std::flush;
+        }
+
+        jobs.requeue_abandoned();
+    }
+
+    if (jobs.completed() < jobs.jobs()) {
+        std::cerr << "\nERROR: " << jobs.jobs() - jobs.completed() << " jobs were never finished.\n";
+        return false;
+    }
+    return jobs.merge_into(image);
+}
+
+#endif
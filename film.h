@@ -0,0 +1,151 @@
+#ifndef FILM_H
+#define FILM_H
+
+#include "rtweekend.h"
+#include "color.h"
+
+#include <cstdio>
+#include <vector>
+
+// Accumulation buffer holding the linear radiance sum and sample count of every pixel,
+// plus the sum of squared luminance deviations (Welford's M2) that adaptive sampling
+// needs to pick up where it left off. Nothing is scaled or clamped until tonemap(), so
+// partial renders of the same image can be merged by adding films together, and the HDR
+// data can be written out losslessly. Pixels are addressed the same way the camera is,
+// with j counted up from the bottom row. A film may cover only a window of the image
+// starting at pixel (x0, y0), which is how render jobs carry their partial results.
+class film {
+    public:
+        film() : width(0), height(0), x0(0), y0(0) {}
+        film(int w, int h, int _x0 = 0, int _y0 = 0)
+            : width(w), height(h), x0(_x0), y0(_y0), sums(3*size_t(w)*h, 0.0f),
+              counts(size_t(w)*h, 0), luminance_m2(size_t(w)*h, 0.0f) {}
+
+        size_t pixel_index(int i, int j) const { return size_t(j - y0)*width + (i - x0); }
+
+        // Overwrites a pixel with an updated estimate that already includes its old samples.
+        void set_pixel(int i, int j, const color& sum, uint32_t count, double m2) {
+            auto p = pixel_index(i, j);
+            sums[3*p]   = static_cast<float>(sum.x());
+            sums[3*p+1] = static_cast<float>(sum.y());
+            sums[3*p+2] = static_cast<float>(sum.z());
+            counts[p] = count;
+            luminance_m2[p] = static_cast<float>(m2);
+        }
+
+        // Combines an independent set of samples into a pixel. The M2 terms are merged with
+        // Chan et al.'s parallel variance update.
+        void add_pixel(int i, int j, const color& sum, uint32_t count, double m2) {
+            auto p = pixel_index(i, j);
+            auto n_a = double(counts[p]);
+            auto n_b = double(count);
+            if (n_a > 0 && n_b > 0) {
+                auto delta = luminance(sum) / n_b - luminance(this->sum(i, j)) / n_a;
+                m2 += delta * delta * n_a * n_b / (n_a + n_b);
+            }
+
+            sums[3*p]   += static_cast<float>(sum.x());
+            sums[3*p+1] += static_cast<float>(sum.y());
+            sums[3*p+2] += static_cast<float>(sum.z());
+            counts[p] += count;
+            luminance_m2[p] += static_cast<float>(m2);
+        }
+
+        color sum(int i, int j) const {
+            auto p = pixel_index(i, j);
+            return color(sums[3*p], sums[3*p+1], sums[3*p+2]);
+        }
+
+        uint32_t count(int i, int j) const { return counts[pixel_index(i, j)]; }
+        double sum_sq_dev(int i, int j) const { return luminance_m2[pixel_index(i, j)]; }
+
+        color average(int i, int j) const {
+            auto n = count(i, j);
+            return n == 0 ? color(0,0,0) : sum(i, j) / n;
+        }
+
+        // Adds another film's samples into this one. The other film's window must lie
+        // inside this one.
+        bool merge(const film& other) {
+            if (other.x0 < x0 || other.y0 < y0
+                || other.x0 + other.width > x0 + width || other.y0 + other.height > y0 + height)
+                return false;
+            for (int j = other.y0; j < other.y0 + other.height; j++)
+                for (int i = other.x0; i < other.x0 + other.width; i++)
+                    add_pixel(i, j, other.sum(i, j), other.count(i, j), other.sum_sq_dev(i, j));
+            return true;
+        }
+
+        // Writes the per-pixel mean radiance as a little-endian Portable Float Map. PFM
+        // stores scanlines bottom to top, which is the order the film already uses.
+        bool write_pfm(const char* filename) const {
+            FILE* f = fopen(filename, "wb");
+            if (!f) return false;
+
+            fprintf(f, "PF\n%d %d\n-1.0\n", width, height);
+            std::vector<float> row(3*size_t(width));
+            for (int j = y0; j < y0 + height; j++) {
+                for (int i = x0; i < x0 + width; i++) {
+                    auto c = average(i, j);
+                    row[3*(i-x0)]   = static_cast<float>(c.x());
+                    row[3*(i-x0)+1] = static_cast<float>(c.y());
+                    row[3*(i-x0)+2] = static_cast<float>(c.z());
+                }
+                fwrite(row.data(), sizeof(float), row.size(), f);
+            }
+
+            return fclose(f) == 0;
+        }
+
+    public:
+        int width, height;
+        int x0, y0;
+        std::vector<float> sums;
+        std::vector<uint32_t> counts;
+        std::vector<float> luminance_m2;
+};
+
+
+// How far a render is from a reference render of the same image, over every channel of
+// the per-pixel means.
+struct image_error {
+    double rmse;
+    double max_error;
+    double mean;
+    double reference_mean;
+};
+
+inline image_error compare_images(const film& image, const film& reference) {
+    image_error error{0, 0, 0, 0};
+    for (int j = image.y0; j < image.y0 + image.height; j++) {
+        for (int i = image.x0; i < image.x0 + image.width; i++) {
+            auto a = image.average(i, j), b = reference.average(i, j);
+            for (int c = 0; c < 3; c++) {
+                auto diff = fabs(a[c] - b[c]);
+                error.rmse += diff * diff;
+                error.max_error = fmax(error.max_error, diff);
+                error.mean += a[c];
+                error.reference_mean += b[c];
+            }
+        }
+    }
+    auto n = 3.0 * image.width * image.height;
+    error.rmse = sqrt(error.rmse / n);
+    error.mean /= n;
+    error.reference_mean /= n;
+    return error;
+}
+
+// Final display step: gamma-corrects and quantizes the film into a top-down 8-bit RGB
+// buffer ready for stbi_write_jpg.
+inline void tonemap(const film& image, uint8_t* buffer) {
+    int index = 0;
+    for (int j = image.y0 + image.height-1; j >= image.y0; j--) {
+        for (int i = image.x0; i < image.x0 + image.width; i++) {
+            auto n = image.count(i, j);
+            write_color(buffer, image.sum(i, j), index, n == 0 ? 1 : n);
+        }
+    }
+}
+
+#endif
@@ -11,7 +11,7 @@ class material;
 struct hit_record {
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat_ptr;
+    const material* mat_ptr;        // owned by the scene's material_table
     double t;
     double u;
     double v;
@@ -27,13 +27,51 @@ class hittable {
     public:
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
         virtual bool bounding_box(double time0, double time1, aabb & output_box) const = 0;
+
+        // Any-hit query for shadow and visibility rays: whether anything lies on r between
+        // t_min and t_max. Unlike hit() it may stop at the first intersection it finds and
+        // never fills in a hit_record. Shapes without a cheaper test fall back on hit().
+        virtual bool occluded(const ray& r, double t_min, double t_max) const {
+            hit_record rec;
+            return hit(r, t_min, t_max, rec);
+        }
+
         virtual double pdf_value(const point3& o, const vec3& v) const {
             return 0.0;
         }
 
-        virtual vec3 random(const vec3& o) const {
+        virtual vec3 random(const vec3& o, sampler& rng) const {
             return vec3(1, 0, 0);
         }
+
+        // hit() for the active lanes of a packet. t_max holds each lane's closest hit so far
+        // and is lowered as closer hits are found; rec[l] receives lane l's hit. Returns
+        // the lanes that hit. Shapes without a SIMD test trace the lanes one at a time.
+        virtual uint32_t hit_packet(const ray_packet& rays, uint32_t active, double t_min,
+                                    double* t_max, hit_record* const* rec) const {
+            uint32_t hits = 0;
+            for (; active; active &= active - 1) {
+                int l = lowest_lane(active);
+                if (hit(rays.get(l), t_min, t_max[l], *rec[l])) {
+                    t_max[l] = rec[l]->t;
+                    hits |= 1u << l;
+                }
+            }
+            return hits;
+        }
+
+        // occluded() for the active lanes of a packet, lane l out to t_max[l]. Returns the
+        // lanes that are blocked.
+        virtual uint32_t occluded_packet(const ray_packet& rays, uint32_t active, double t_min,
+                                         const double* t_max) const {
+            uint32_t blocked = 0;
+            for (; active; active &= active - 1) {
+                int l = lowest_lane(active);
+                if (occluded(rays.get(l), t_min, t_max[l]))
+                    blocked |= 1u << l;
+            }
+            return blocked;
+        }
 };
 
 class translate : public hittable {
@@ -46,13 +84,25 @@ class translate : public hittable {
 
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
 
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+            return ptr->occluded(r.moved(r.origin() - offset, r.direction()), t_min, t_max);
+        }
+
+        virtual double pdf_value(const point3& o, const vec3& v) const override {
+            return ptr->pdf_value(o - offset, v);
+        }
+
+        virtual vec3 random(const point3& o, sampler& rng) const override {
+            return ptr->random(o - offset, rng);
+        }
+
     public:
         shared_ptr<hittable> ptr;
         vec3 offset;
 };
 
 bool translate::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    ray moved_r(r.origin() - offset, r.direction(), r.time());
+    ray moved_r = r.moved(r.origin() - offset, r.direction());
     if (!ptr->hit(moved_r, t_min, t_max, rec))
         return false;
 
@@ -80,11 +130,19 @@ class rotate_y : public hittable {
         virtual bool hit(
             const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+            return ptr->occluded(rotate(r), t_min, t_max);
+        }
+
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
             output_box = bbox;
             return hasbox;
         }
 
+    private:
+        // r in the object's own frame.
+        ray rotate(const ray& r) const;
+
     public:
         shared_ptr<hittable> ptr;
         double sin_theta;
@@ -125,7 +183,7 @@ rotate_y::rotate_y(shared_ptr<hittable> p, double angle) : ptr(p) {
     bbox = aabb(min, max);
 }
 
-bool rotate_y::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+ray rotate_y::rotate(const ray& r) const {
     auto origin = r.origin();
     auto direction = r.direction();
 
@@ -135,7 +193,11 @@ bool rotate_y::hit(const ray& r, double t_min, double t_max, hit_record& rec) co
     direction[0] = cos_theta*r.direction()[0] - sin_theta*r.direction()[2];
     direction[2] = sin_theta*r.direction()[0] + cos_theta*r.direction()[2];
 
-    ray rotated_r(origin, direction, r.time());
+    return r.moved(origin, direction);
+}
+
+bool rotate_y::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    ray rotated_r = rotate(r);
 
     if (!ptr->hit(rotated_r, t_min, t_max, rec))
         return false;
@@ -169,10 +231,22 @@ class flip_face : public hittable {
             return true;
         }
 
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+            return ptr->occluded(r, t_min, t_max);
+        }
+
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
             return ptr->bounding_box(time0, time1, output_box);
         }
 
+        virtual double pdf_value(const point3& o, const vec3& v) const override {
+            return ptr->pdf_value(o, v);
+        }
+
+        virtual vec3 random(const point3& o, sampler& rng) const override {
+            return ptr->random(o, rng);
+        }
+
     public:
         shared_ptr<hittable> ptr;
 };
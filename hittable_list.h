@@ -3,6 +3,7 @@
 
 #include "hittable.h"
 
+#include <algorithm>
 #include <memory>
 #include <vector>
 
@@ -20,6 +21,49 @@ class hittable_list : public hittable {
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
 
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+            for (const auto& object : objects)
+                if (object->occluded(r, t_min, t_max))
+                    return true;
+            return false;
+        }
+
+        virtual uint32_t hit_packet(const ray_packet& rays, uint32_t active, double t_min,
+                                    double* t_max, hit_record* const* rec) const override {
+            uint32_t hits = 0;
+            for (const auto& object : objects)
+                hits |= object->hit_packet(rays, active, t_min, t_max, rec);
+            return hits;
+        }
+
+        virtual uint32_t occluded_packet(const ray_packet& rays, uint32_t active, double t_min,
+                                         const double* t_max) const override {
+            uint32_t blocked = 0;
+            for (const auto& object : objects) {
+                blocked |= object->occluded_packet(rays, active & ~blocked, t_min, t_max);
+                if (blocked == active)
+                    break;
+            }
+            return blocked;
+        }
+
+        // As a light list: pick one member uniformly and sample it.
+        virtual double pdf_value(const point3& o, const vec3& v) const override {
+            auto weight = 1.0 / objects.size();
+            auto sum = 0.0;
+
+            for (const auto& object : objects)
+                sum += weight * object->pdf_value(o, v);
+
+            return sum;
+        }
+
+        virtual vec3 random(const vec3& o, sampler& rng) const override {
+            auto int_size = static_cast<int>(objects.size());
+            auto index = std::min(static_cast<int>(rng.random_double() * int_size), int_size - 1);
+            return objects[index]->random(o, rng);
+        }
+
     public:
         std::vector<shared_ptr<hittable>> objects;
 };
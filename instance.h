@@ -0,0 +1,137 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "transform.h"
+
+// One placement of a shared hittable under an arbitrary affine transform. The shared
+// object is usually a bvh_node built once as a bottom-level hierarchy; a bvh_node over the
+// instances is then the top level. Rays are taken into the object's space instead of the
+// object into the world, so a thousand placements cost a thousand of these rather than a
+// thousand copies of the geometry, and each costs one transform per ray however it was
+// composed, where translate and rotate_y cost one per wrapper.
+//
+// Distances along a ray are the same in both spaces, since the ray is transformed as a
+// whole and its direction is not renormalized.
+class instance : public hittable {
+    public:
+        // to_world must be invertible (see affine_transform::inverse()).
+        instance(shared_ptr<hittable> p, const affine_transform& to_world);
+
+        virtual bool hit(
+            const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+            return ptr->occluded(to_object_ray(r), t_min, t_max);
+        }
+
+        virtual uint32_t hit_packet(const ray_packet& rays, uint32_t active, double t_min,
+                                    double* t_max, hit_record* const* rec) const override;
+
+        virtual uint32_t occluded_packet(const ray_packet& rays, uint32_t active, double t_min,
+                                         const double* t_max) const override {
+            ray_packet object_rays;
+            for (int l = 0; l < rays.size; l++)
+                object_rays.add(to_object_ray(rays.get(l)));
+            return ptr->occluded_packet(object_rays, active, t_min, t_max);
+        }
+
+        virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
+            output_box = bbox;
+            return hasbox;
+        }
+
+        // A linear map A scales the density of directions through it by |det A| / |A w|^3
+        // at unit w, and to_object is the map from world directions to the object's.
+        virtual double pdf_value(const point3& o, const vec3& v) const override {
+            auto object_v = to_object.vector(v);
+            auto ratio = v.length() / object_v.length();
+            return ptr->pdf_value(to_object.point(o), object_v) * object_det * ratio*ratio*ratio;
+        }
+
+        virtual vec3 random(const point3& o, sampler& rng) const override {
+            return to_world.vector(ptr->random(to_object.point(o), rng));
+        }
+
+    public:
+        shared_ptr<hittable> ptr;
+        affine_transform to_world;
+        affine_transform to_object;
+
+    private:
+        bool hasbox;
+        aabb bbox;
+        double object_det;      // |determinant| of to_object
+
+        ray to_object_ray(const ray& r) const;
+
+        // Moves a hit found in object space into the world. The linear part preserves the
+        // sign of dot(direction, normal), so front_face carries over unchanged.
+        void to_world_record(hit_record& rec) const;
+};
+
+// The transforms are kept out of line so hit() and hit_packet() run the one compiled copy.
+// Inlined into each, the compiler is free to fuse multiply-adds differently in the two,
+// and a last-bit difference in a hit point is enough to send a path through a volume
+// somewhere else, so packet and scalar renders would no longer match.
+#if defined(__GNUC__)
+#define INSTANCE_NOINLINE __attribute__((noinline))
+#else
+#define INSTANCE_NOINLINE
+#endif
+
+INSTANCE_NOINLINE ray instance::to_object_ray(const ray& r) const {
+    return r.moved(to_object.point(r.origin()), to_object.vector(r.direction()));
+}
+
+INSTANCE_NOINLINE void instance::to_world_record(hit_record& rec) const {
+    rec.p = to_world.point(rec.p);
+    rec.normal = unit_vector(to_object.transposed_vector(rec.normal));
+}
+
+instance::instance(shared_ptr<hittable> p, const affine_transform& xf)
+    : ptr(p), to_world(xf), to_object(affine_transform::identity()) {
+    to_world.inverse(to_object);
+    object_det = fabs(to_object.determinant());
+    hasbox = ptr->bounding_box(0, 1, bbox);
+
+    point3 min( infinity,  infinity,  infinity);
+    point3 max(-infinity, -infinity, -infinity);
+
+    for (int i = 0; i < 8; i++) {
+        auto corner = to_world.point(point3(bbox.corner(i & 1).x(), bbox.corner((i >> 1) & 1).y(),
+                                            bbox.corner(i >> 2).z()));
+        for (int c = 0; c < 3; c++) {
+            min[c] = fmin(min[c], corner[c]);
+            max[c] = fmax(max[c], corner[c]);
+        }
+    }
+
+    bbox = aabb(min, max);
+}
+
+bool instance::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    if (!ptr->hit(to_object_ray(r), t_min, t_max, rec))
+        return false;
+
+    to_world_record(rec);
+    return true;
+}
+
+uint32_t instance::hit_packet(
+    const ray_packet& rays, uint32_t active, double t_min, double* t_max, hit_record* const* rec
+) const {
+    // Transforming every lane keeps lane numbers, and with them t_max and rec, the same.
+    ray_packet object_rays;
+    for (int l = 0; l < rays.size; l++)
+        object_rays.add(to_object_ray(rays.get(l)));
+
+    auto hits = ptr->hit_packet(object_rays, active, t_min, t_max, rec);
+    for (auto lanes = hits; lanes; lanes &= lanes - 1)
+        to_world_record(*rec[lowest_lane(lanes)]);
+    return hits;
+}
+
+#endif
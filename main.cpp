@@ -1,6 +1,11 @@
+#include <cassert>
 #include <iostream>
+#include <memory>
 #include <math.h>
 #include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
 #include "bvh.h"
 #include "rtweekend.h"
 #include "vec3.h"
@@ -12,12 +17,27 @@
 #include "material.h"
 #include "aarect.h"
 #include "box.h"
+#include "direct_light.h"
 #include "pdf.h"
-//#include "constant_medium.h"
+#include "roulette.h"
+#include "scene.h"
+#include "scene_loader.h"
+#include "builtin_scenes.h"
+#include "options.h"
 //#include "turbulent_medium.h"
 #include "moving_sphere.h"
+#include "tile_scheduler.h"
+#include "film.h"
+#include "adaptive.h"
+#include "checkpoint.h"
+#include "distributed.h"
+#include "wavefront.h"
+#include "bench.h"
 
 
+#define ALLOC_COUNTER_IMPLEMENTATION
+#include "alloc_counter.h"
+
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
@@ -34,393 +54,290 @@ color lerp(color a, color b, double t) {
     return (1.0 - t) * a + t*b;
 }
 
-color ray_color(const ray& r, const color & background, const hittable & world, shared_ptr<hittable>& lights, int depth) {
+// Follows one camera path bounce by bounce, carrying the path's throughput (the weight of
+// everything behind the current ray) instead of recursing. Surfaces that importance sample
+// also take a light sample at every bounce, with a shadow ray (see direct_light.h).
+// Russian roulette (see roulette.h) may end the path once its remaining depth drops to
+// roulette_depth. Nothing in here touches the heap.
+color ray_color(ray r, const color& background, const hittable& world, const hittable* lights,
+                int max_depth, int roulette_depth, sampler& rng) {
+    color radiance(0,0,0);
+    color throughput(1,1,1);
     hit_record rec;
+    double bsdf_pdf = 0;    // see weighted_emission()
+
+    for (int depth = max_depth; depth > 0; depth--) {
+        // If the ray hits nothing, return the background color.
+        r.sample_media(rng);
+        if (!world.hit(r, 0.001, infinity, rec)) {
+            radiance += throughput * background;
+            break;
+        }
+
+        radiance += throughput * weighted_emission(lights, r, rec, bsdf_pdf);
+
+        ray scattered;
+        double pdf_val;
+        color albedo;
+        if (!rec.mat_ptr->scatter(r, rec, albedo, scattered, pdf_val, rng))
+            break;
+
+        color weight = albedo;
+        bsdf_pdf = 0;
+        if (!rec.mat_ptr->skip_pdf()) {
+            if (lights) {
+                light_sample sample;
+                if (sample_light(*lights, r, rec, albedo, rng, sample)
+                    && !world.occluded(sample.shadow, 0.001, sample.t_max))
+                    radiance += throughput * sample.radiance;
+                bsdf_pdf = pdf_val;
+            }
+            weight = albedo * rec.mat_ptr->scattering_pdf(r, rec, scattered) / pdf_val;
+        }
 
-    if (depth <= 0) return color(0,0,0);
-
-    // If the ray hits nothing, return the background color.
-    if (!world.hit(r, 0.001, infinity, rec))
-        return background;
-
-    ray scattered;
-    color attenuation;
-    color emitted = rec.mat_ptr->emitted(r, rec, rec.u, rec.v, rec.p);
-    double pdf_val;
-    color albedo;
-
-    if (!rec.mat_ptr->scatter(r, rec, albedo, scattered, pdf_val))
-        return emitted;
-
-    auto p0 = make_shared<hittable_pdf>(lights, rec.p);
-    auto p1 = make_shared<cosine_pdf>(rec.normal);
-    mixture_pdf mixed_pdf(p0, p1);
-
-    scattered = ray(rec.p, mixed_pdf.generate(), r.time());
-    pdf_val = mixed_pdf.value(scattered.direction());
-
-    return emitted
-         + albedo * rec.mat_ptr->scattering_pdf(r, rec, scattered)
-                  * ray_color(scattered, background, world, lights, depth-1) / pdf_val;
-}
-
-// hittable_list moon() {
-//     hittable_list objects;
-
-//     auto light = make_shared<diffuse_light>(color(10, 10, 10));
-
-//     objects.add(make_shared<sphere>(point3(30,0,0), 5, light));
-//     //objects.add(make_shared<sphere>(point3(0,0,5), 1, light));
-
-
-//     auto moon_texture = make_shared<image_texture>("moon.jpg");
-//     auto moon_surface = make_shared<nayer>(moon_texture);
-//     objects.add(make_shared<sphere>(point3(0,0,0), 2, moon_surface));
-
-//     return objects;
-// }
-
-
-hittable_list cornell_box() {
-    hittable_list objects;
-
-    auto red   = make_shared<lambertian>(color(.65, .05, .05));
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    auto green = make_shared<lambertian>(color(.12, .45, .15));
-    auto light = make_shared<diffuse_light>(color(15, 15, 15));
-
-    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
-    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
-    objects.add(make_shared<flip_face>(make_shared<xz_rect>(213, 343, 227, 332, 554, light)));
-    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
-    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
-    objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
-
-    shared_ptr<hittable> box1 = make_shared<box>(point3(0,0,0), point3(165,330,165), white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265,0,295));
-    objects.add(box1);
+        auto survival = survival_probability(throughput * weight, depth, roulette_depth);
+        if (survival < 1.0) {
+            if (rng.random_double() >= survival)
+                break;
+            weight /= survival;
+        }
 
-    shared_ptr<hittable> box2 = make_shared<box>(point3(0,0,0), point3(165,165,165), white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3(130,0,65));
-    objects.add(box2);
+        throughput = throughput * weight;
+        r = scattered;
+    }
 
-    return objects;
+    return radiance;
 }
 
-// hittable_list simple_light() {
-//     hittable_list objects;
-
-//     auto pertext = make_shared<noise_texture>(10);
-//     shared_ptr<hittable> sphere1 = make_shared<sphere>(point3(0,100,0), 100, make_shared<lambertian>(pertext));
-//     objects.add(make_shared<constant_medium>(sphere1, 0.01, pertext));
-//     objects.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(pertext)));
-
-//     objects.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<dielectric>(1.5)));
-//     shared_ptr<hittable> boundary = make_shared<sphere>(point3(0,2,0), 1.99, make_shared<lambertian>(pertext)); // 0.94 0.5 0.5
-//     objects.add(make_shared<constant_medium>(boundary, .2, pertext));
-
-
-//     auto difflight = make_shared<diffuse_light>(color(5,5,5));
-//     objects.add(make_shared<xy_rect>(3, 7, 1, 5, -5, difflight));
-
-//     return objects;
-// }
-
-// hittable_list bubble() {
-//     hittable_list objects;
-
-//     objects.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(color(.50, .8, 0.23))));
-
-//     auto bubbletex = make_shared<bubble_texture>(pi);
-//     objects.add(make_shared<sphere>(point3(0,2,0), -1.99, make_shared<dielectric>(1.0, bubbletex)));
-//     objects.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<dielectric>(1.0, bubbletex)));
-
-//     auto difflight = make_shared<diffuse_light>(color(5,5,5));
-//     objects.add(make_shared<xy_rect>(3, 7, 1, 5, -5, difflight));
-    
-//     return objects;
-// }
-
-// hittable_list clouds() {
-//     hittable_list objects;
-
-//     shared_ptr<hittable> boundary = make_shared<sphere>(point3(0,2,0), 1.99, make_shared<lambertian>(color(1.0, 1.0, 1.0)));
-
-//     objects.add(make_shared<turbulent_medium>(boundary, .5, color(1., 0., 0.)));
-
-//     objects.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(color(.50, .8, 0.23))));
-//     objects.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<dielectric>(1.0, color(1.0, 1.0, 1.0))));
-
-//     //auto difflight = make_shared<diffuse_light>(color(5,5,5));
-//     //objects.add(make_shared<xy_rect>(3, 13, 1, 11, -50, difflight));
-    
-//     return objects;
-// }
-
-// hittable_list two_perlin_spheres() {
-//     hittable_list objects;
-
-//     auto pertext = make_shared<noise_texture>(pi);
-//     objects.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(pertext)));
-//     objects.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<lambertian>(pertext)));
-
-//     return objects;
-// }
-
-// hittable_list two_spheres() {
-//     hittable_list objects;
-
-//     auto checker = make_shared<checker_texture>(color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
-
-//     auto moon_texture = make_shared<image_texture>("moon.jpg");
-//     auto moon_surface = make_shared<nayer>(moon_texture);
+int main(int argc, char* argv[]) {
+    render_options opts;
+    if (!parse_options(argc, argv, opts))
+        return 1;
+
+    if (opts.show_help) {
+        print_usage(argv[0]);
+        return 0;
+    }
+    if (opts.list_scenes) {
+        for (auto& entry : builtin_scenes)
+            printf("%-20s %s\n", entry.name, entry.description);
+        return 0;
+    }
+
+    // Scenes build their BVHs as they are set up, so these have to be in place first.
+    default_bvh_settings().width = opts.bvh_width;
+    default_bvh_settings().num_threads = opts.num_threads;
+    default_bvh_settings().report = opts.bench;
+
+    // A coordinator only hands out jobs and merges what comes back, so it needs the scene's
+    // image settings but not its geometry; its workers build that for themselves.
+    bool geometry = opts.num_workers == 0 || opts.bench;
+    scene scn;
+
+    if (auto builtin = find_builtin_scene(opts.scene_name.c_str())) {
+        if (geometry)
+            scn = builtin->build();
+        else
+            builtin->settings(scn);
+    } else {
+        auto start = std::chrono::steady_clock::now();
+        if (!scene_loader().load(opts.scene_name.c_str(), scn, geometry))
+            return 1;
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cerr << "Loaded '" << opts.scene_name << "' in " << elapsed.count() << "s\n";
+    }
+    opts.apply_to(scn);
+
+    if (opts.bench) {
+        run_ray_benchmark(scn, scn.image_width, opts.final_image_height(scn), opts.seed);
+        return 0;
+    }
+
+    const int tile_size = opts.tile_size;
+    const int num_threads = opts.num_threads;
+    uint64_t seed = opts.seed;  // a resumed checkpoint keeps its own seed
+    const adaptive_settings& adaptive = opts.adaptive;
+    const char* checkpoint_path = opts.checkpoint_path.c_str();
+
+    int image_width = scn.image_width;
+    int image_height = opts.final_image_height(scn);
+    int samples_per_pixel = scn.samples_per_pixel;
+    int max_depth = scn.max_depth;
+    int roulette_depth = max_depth - opts.roulette_bounces;
+
+    // Everything a worker has to agree on with its coordinator, and a resumed render with
+    // the run that checkpointed it.
+    auto render_settings = [&](uint64_t render_seed) {
+        char text[256];
+        snprintf(text, sizeof(text), "%d %d %d %d %d %llu %d %g %d %d %d\n", image_width, image_height,
+                 samples_per_pixel, max_depth, roulette_depth, (unsigned long long)render_seed,
+                 adaptive.enabled, adaptive.threshold, adaptive.min_spp, adaptive.max_spp, opts.wavefront);
+        return std::string(text);
+    };
+    auto settings = render_settings(seed);
+
+    film image(image_width, image_height);
+    auto render_start = std::chrono::steady_clock::now();
+    double earlier_seconds = 0;     // render time of the runs a resumed checkpoint holds
+
+    if (opts.num_workers > 0) {
+        if (!run_coordinator(opts.job_dir, opts.num_workers, opts.job_size, settings, opts.worker_argv, image))
+            return 1;
+    } else {
+        camera cam = scn.make_camera();
+
+        // One wavefront integrator per scheduler thread, created on first use so they pick
+        // up the seed of a resumed checkpoint.
+        std::vector<std::unique_ptr<wavefront_integrator>> integrators(num_threads);
+
+        // Renders every pixel of t into target, continuing from whatever samples target
+        // already holds for it, and commits the finished tile under target_lock.
+        auto render_tile = [&](const tile& t, int worker, film& target, std::mutex& target_lock) {
+            std::vector<pixel_estimator> estimates;
+            estimates.reserve((t.x1 - t.x0) * (t.y1 - t.y0));
+            for (int j = t.y1-1; j >= t.y0; j--)
+                for (int i = t.x0; i < t.x1; i++)
+                    estimates.emplace_back(target.sum(i, j), target.count(i, j), target.sum_sq_dev(i, j));
+
+            if (opts.wavefront) {
+                auto& integrator = integrators[worker];
+                if (!integrator)
+                    integrator = std::make_unique<wavefront_integrator>(
+                        scn, cam, image_width, image_height, seed, max_depth, roulette_depth,
+                        opts.wave_size, opts.packet_size);
+                integrator->render_tile(t, estimates, adaptive, samples_per_pixel);
+            } else {
+                auto allocations = allocation_count();
+                auto est = estimates.begin();
+                for (int j = t.y1-1; j >= t.y0; j--) {
+                    for (int i = t.x0; i < t.x1; i++, ++est) {
+                        // Every sample is keyed on (seed, pixel, sample index), so the image is the
+                        // same whichever thread or process renders the pixel, and a resumed pixel
+                        // simply continues at the sample index after its last saved one.
+                        sampler rng(seed, i, j);
+
+                        for (int batch; (batch = samples_wanted(*est, adaptive, samples_per_pixel)) > 0; ) {
+                            for (int s = est->count(); batch > 0; ++s, --batch) {
+                                rng.start_sample(s);
+                                auto u = (i + rng.random_double()) / (image_width-1);
+                                auto v = (j + rng.random_double()) / (image_height-1);
+                                ray r  = cam.get_ray(u, v, rng);
+                                est->add(ray_color(r, scn.background, scn.world, scn.lights.get(),
+                                                   max_depth, roulette_depth, rng));
+                            }
+                        }
+                    } // iterate over tile width
+                } // iterate over tile height
+                assert(allocation_count() == allocations && "render loop allocated");
+            }
 
-//     objects.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<nayer>(checker)));
-//     objects.add(make_shared<sphere>(point3(1, 1, 0), 1, moon_surface));
-//     objects.add(make_shared<sphere>(point3(-1, 1, 0), 1, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+            // Commit the whole tile at once so checkpoints only ever see finished tiles.
+            std::lock_guard<std::mutex> guard(target_lock);
+            auto est = estimates.begin();
+            for (int j = t.y1-1; j >= t.y0; j--)
+                for (int i = t.x0; i < t.x1; i++, ++est)
+                    target.set_pixel(i, j, est->sum(), est->count(), est->sum_sq_dev());
+        };
+
+        if (!opts.worker_dir.empty()) {
+            return run_worker(opts.worker_dir, settings, seed, [&](const tile& region, film& window) {
+                std::mutex window_lock;
+                tile_scheduler scheduler(region, tile_size, num_threads, false);
+                scheduler.run([&](const tile& t, int worker) { render_tile(t, worker, window, window_lock); });
+            });
+        }
+
+        // A checkpoint that can't be resumed is an error rather than a fresh start, since
+        // the render would then overwrite it.
+        checkpoint_header resumed;
+        auto status = opts.resume ? load_checkpoint(checkpoint_path, image, seed, &resumed)
+                                  : checkpoint_status::missing;
+        if (status == checkpoint_status::invalid) {
+            std::cerr << "ERROR: Checkpoint '" << checkpoint_path << "' is unreadable or from another "
+                      << "checkpoint version.\n";
+            return 1;
+        }
+        if (status == checkpoint_status::loaded) {
+            if (image.width != image_width || image.height != image_height) {
+                std::cerr << "ERROR: Checkpoint '" << checkpoint_path << "' is " << image.width << "x"
+                          << image.height << ", not " << image_width << "x" << image_height << ".\n";
+                return 1;
+            }
+            settings = render_settings(seed);
+            if (resumed.settings_hash != checkpoint_settings_hash(settings)) {
+                std::cerr << "ERROR: Checkpoint '" << checkpoint_path << "' was rendered with different "
+                          << "settings.\n";
+                return 1;
+            }
+            earlier_seconds = resumed.render_seconds;
+            std::cerr << "Resuming from checkpoint '" << checkpoint_path << "'.\n";
+        }
 
-//     return objects;
-// }
+        std::mutex film_lock;
+        checkpointer saver(checkpoint_path, opts.checkpoint_interval, seed,
+                           checkpoint_settings_hash(settings), earlier_seconds);
 
-// hittable_list random_scene() {
-//     hittable_list world;
+        tile_scheduler scheduler(image_width, image_height, tile_size, num_threads);
+        scheduler.run([&](const tile& t, int worker) {
+            render_tile(t, worker, image, film_lock);
+            saver.update(image, film_lock);
+        });
+    }
 
-//     // auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-//     // world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - render_start;
+    double render_seconds = earlier_seconds + elapsed.count();
 
-//     auto checker = make_shared<checker_texture>(color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
-//     world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(checker)));
-
-//     for (int a = -11; a < 11; a++) {
-//         for (int b = -11; b < 11; b++) {
-//             auto choose_mat = random_double();
-//             point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+    if (!save_checkpoint(checkpoint_path, image, seed, checkpoint_settings_hash(settings), render_seconds))
+        std::cerr << "\nERROR: Could not write checkpoint '" << checkpoint_path << "'.";
 
-//             if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-//                 shared_ptr<material> sphere_material;
-
-//                 if (choose_mat < 0.8) {
-//                     // diffuse
-//                     auto albedo = color::random() * color::random();
-//                     sphere_material = make_shared<lambertian>(albedo);
-//                     world.add(make_shared<sphere>(center, 0.2, sphere_material));
-//                 } else if (choose_mat < 0.95) {
-//                     // metal
-//                     auto albedo = color::random(0.5, 1);
-//                     auto fuzz = random_double(0, 0.5);
-//                     sphere_material = make_shared<metal>(albedo, fuzz);
-//                     world.add(make_shared<sphere>(center, 0.2, sphere_material));
-//                 } else {
-//                     // glass
-//                     sphere_material = make_shared<dielectric>(1.5);
-//                     world.add(make_shared<sphere>(center, 0.2, sphere_material));
-//                 }
-//             }
-//         }
-//     }
-
-//     auto material1 = make_shared<dielectric>(1.5);
-//     world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-//     auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-//     world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-//     auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-//     world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-
-//     return hittable_list(make_shared<bvh_node>(world, 1.0, 1.0));
-// }
-
-// // hittable_list final_scene() {
-//     hittable_list boxes1;
-//     auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
-
-//     const int boxes_per_side = 20;
-//     for (int i = 0; i < boxes_per_side; i++) {
-//         for (int j = 0; j < boxes_per_side; j++) {
-//             auto w = 100.0;
-//             auto x0 = -1000.0 + i*w;
-//             auto z0 = -1000.0 + j*w;
-//             auto y0 = 0.0;
-//             auto x1 = x0 + w;
-//             auto y1 = random_double(1,101);
-//             auto z1 = z0 + w;
-
-//             boxes1.add(make_shared<box>(point3(x0,y0,z0), point3(x1,y1,z1), ground));
-//         }
-//     }
-
-//     hittable_list objects;
-
-//     objects.add(make_shared<bvh_node>(boxes1, 0, 1));
-
-//     auto light = make_shared<diffuse_light>(color(7, 7, 7));
-//     objects.add(make_shared<xz_rect>(123, 423, 147, 412, 554, light));
-
-//     auto center1 = point3(400, 400, 200);
-//     auto center2 = center1 + vec3(30,0,0);
-//     auto moving_sphere_material = make_shared<lambertian>(color(0.7, 0.3, 0.1));
-//     objects.add(make_shared<moving_sphere>(center1, center2, 0, 1, 50, moving_sphere_material));
-
-//     objects.add(make_shared<sphere>(point3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
-//     objects.add(make_shared<sphere>(
-//         point3(0, 150, 145), 50, make_shared<metal>(color(0.8, 0.8, 0.9), 1.0)
-//     ));
-
-//     auto boundary = make_shared<sphere>(point3(360,150,145), 70, make_shared<dielectric>(1.5));
-//     objects.add(boundary);
-//     objects.add(make_shared<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9)));
-//     boundary = make_shared<sphere>(point3(0, 0, 0), 5000, make_shared<dielectric>(1.5));
-//     objects.add(make_shared<constant_medium>(boundary, .0001, color(1,1,1)));
-
-//     auto emat = make_shared<lambertian>(make_shared<image_texture>("earthmap.jpg"));
-//     objects.add(make_shared<sphere>(point3(400,200,400), 100, emat));
-//     auto pertext = make_shared<noise_texture>(0.1);
-//     objects.add(make_shared<sphere>(point3(220,280,300), 80, make_shared<lambertian>(pertext)));
-
-//     hittable_list boxes2;
-//     auto white = make_shared<lambertian>(color(.73, .73, .73));
-//     int ns = 1000;
-//     for (int j = 0; j < ns; j++) {
-//         boxes2.add(make_shared<sphere>(point3::random(0,165), 10, white));
-//     }
-
-//     objects.add(make_shared<translate>(
-//         make_shared<rotate_y>(
-//             make_shared<bvh_node>(boxes2, 0.0, 1.0), 15),
-//             vec3(-100,270,395)
-//         )
-//     );
-
-//     return objects;
-// }
-
-int main() {
-    // image configurations
-    auto aspect_ratio = 1.0;
-    int image_width = 600;
-    int image_height = static_cast<int>(image_width / aspect_ratio);
-    int samples_per_pixel = 100;
-    int max_depth = 50;
-
-    hittable_list world;
-
-    point3 lookfrom;
-    point3 lookat;
-    auto vfov = 45.0;
-    auto aperture = 0.0;
-    color background(0,0,0);
-
-
-    world = cornell_box();
-    shared_ptr<hittable> lights = make_shared<xz_rect>(213, 343, 227, 332, 554, shared_ptr<material>());
-    aspect_ratio = 1.0;
-    image_width = 600;
-    samples_per_pixel = 1000;
-    lookfrom = point3(278, 278, -800);
-    lookat = point3(278, 278, 0);
-    vfov = 40.0;
-
-//    switch (6) {
-//         case 1:
-//             world = random_scene();
-//             background = color(0.70, 0.80, 1.00);
-//             lookfrom = point3(13,2,3);
-//             lookat = point3(0,0,0);
-//             vfov = 20.0;
-//             aperture = 0.1;
-//             break;
-
-//         case 2:
-//             world = two_spheres();
-//             background = color(0.70, 0.80, 1.00);
-//             lookfrom = point3(0,1,-10);
-//             lookat = point3(0,1,0);
-//             vfov = 20.0;
-//             break;
-
-//         case 3:
-//             world = two_perlin_spheres();
-//             background = color(0.70, 0.80, 1.00);
-//             lookfrom = point3(13,2,3);
-//             lookat = point3(0,0,0);
-//             vfov = 20.0;
-//             break;
-
-//         case 4:
-//             world = bubble();
-//             background = color(0.70, 0.80, 1.00);
-//             samples_per_pixel = 250;
-//             lookfrom = point3(26,3,6);
-//             lookat = point3(0,2,0);
-//             vfov = 10.0;
-//             break;
-//         case 5:
-//             world = moon();
-//             samples_per_pixel = 1000;
-//             lookfrom = point3(13,2,3);
-//             lookat = point3(0,0,0);
-//             vfov = 20.0;
-//             break;          
-//         case 6:
-//             world = cornell_box();
-//             aspect_ratio = 1.0;
-//             image_width = 600;
-//             samples_per_pixel = 250;
-//             lookfrom = point3(278, 278, -800);
-//             lookat = point3(278, 278, 0);
-//             vfov = 40.0;
-//             break;
-//         case 7:
-//             world = final_scene();
-//             aspect_ratio = 1.0;
-//             image_width = 800;
-//             samples_per_pixel = 5000;
-//             background = color(0,0,0);
-//             lookfrom = point3(478, 278, -600);
-//             lookat = point3(278, 278, 0);
-//             vfov = 40.0;
-//             break;
-//         default:
-//         case 8:
-//             world = clouds();
-//             background = color(0.70, 0.80, 1.00);
-//             samples_per_pixel = 100;
-//             lookfrom = point3(26,3,6);
-//             lookat = point3(0,2,0);
-//             vfov = 20.0;
-//             break;        
-//     }
-
-    // Camera
-
-    vec3 vup(0,1,0);
-    auto dist_to_focus = 10.0;
-
-    camera cam(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus, 0.0, 1.0);
-
-    // create buffer of pixel data
-    uint8_t * pixels = new uint8_t [ image_width * image_height * NUM_CHANNELS];
-    
-    int index = 0;
-    for (int j = image_height-1; j >= 0; j--) {
-        int percent_left = static_cast<int>(100*((float)j/(float)image_height));
-        std::cerr << "\rScanlines Remaining: " << j << " | " << percent_left << "\% left" << " | "<< std::flush;
-        for (int i = 0; i < image_width; i++) {
-            color pixel_color(0, 0, 0);
-            for (int s = 0; s < samples_per_pixel; ++s) {
-                auto u = (i + random_double()) / (image_width-1);
-                auto v = (j + random_double()) / (image_height-1);
-                ray r  = cam.get_ray(u, v);
-                pixel_color += ray_color(r, background, world, lights, max_depth);
-            }
-            write_color(pixels, pixel_color, index, samples_per_pixel);
-        } // iterate over width
-    } // iterate over height
+    // Linear HDR radiance first; the 8-bit image is only a tonemapped view of it.
+    auto pfm_path = opts.output_path(".pfm");
+    if (!image.write_pfm(pfm_path.c_str()))
+        std::cerr << "\nERROR: Could not write " << pfm_path << ".";
 
     // Write Image Using stbi_image_write
-    stbi_write_jpg("out.jpg", image_width, image_height, NUM_CHANNELS, pixels, 100);
+    std::vector<uint8_t> pixels(image_width * image_height * NUM_CHANNELS);
+    tonemap(image, pixels.data());
+    stbi_write_jpg(opts.output_path(".jpg").c_str(), image_width, image_height, NUM_CHANNELS, pixels.data(), 100);
+
+    if (adaptive.enabled) {
+        // Sample-count map: brighter pixels took more of the budget.
+        long long total_samples = 0;
+        for (auto n : image.counts) total_samples += n;
+        std::cerr << "\nAverage samples per pixel: " << double(total_samples) / image.counts.size();
+
+        std::vector<uint8_t> sample_map(image_width * image_height);
+        write_sample_map(sample_map.data(), image, adaptive.max_spp);
+        stbi_write_png(opts.output_path("_spp.png").c_str(), image_width, image_height, 1, sample_map.data(), image_width);
+    }
+    std::cerr << "\nRendered in " << render_seconds << "s with " << 8 * sizeof(real) << "-bit vectors.";
+
+    if (!opts.compare.empty()) {
+        film reference;
+        uint64_t reference_seed;
+        checkpoint_header reference_header;
+        if (load_checkpoint(opts.compare.c_str(), reference, reference_seed, &reference_header)
+                != checkpoint_status::loaded) {
+            std::cerr << "\nERROR: Could not read checkpoint '" << opts.compare << "'.\n";
+            return 1;
+        }
+        if (reference.width != image_width || reference.height != image_height) {
+            std::cerr << "\nERROR: Checkpoint '" << opts.compare << "' is " << reference.width << "x"
+                      << reference.height << ", not " << image_width << "x" << image_height << ".\n";
+            return 1;
+        }
+
+        // Renders from different seeds differ by their noise as well, so compare like with like.
+        auto error = compare_images(image, reference);
+        auto reference_seconds = reference_header.render_seconds;
+        fprintf(stderr, "\nCompared with '%s' (%d-bit vectors%s):", opts.compare.c_str(),
+                reference_header.real_bits, reference_seed == seed ? "" : ", different seed");
+        fprintf(stderr, "\n  time ratio   %.3fx (%.3fs vs %.3fs)", reference_seconds / render_seconds,
+                render_seconds, reference_seconds);
+        fprintf(stderr, "\n  rms error    %.6g", error.rmse);
+        fprintf(stderr, "\n  max error    %.6g", error.max_error);
+        fprintf(stderr, "\n  mean         %.6g vs %.6g (%+.4f%%)", error.mean, error.reference_mean,
+                100 * (error.mean - error.reference_mean) / error.reference_mean);
+    }
     std::cerr << "\nDone.\n";
 }
\ No newline at end of file
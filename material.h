@@ -8,6 +8,10 @@
 #include "ONB.h"
 #include "pdf.h"
 
+#include <memory>
+#include <utility>
+#include <vector>
+
 struct hit_record;
 
 // inline vec3 random_cosine_direction() {
@@ -23,9 +27,11 @@ struct hit_record;
 
 class material {
     public:
+        virtual ~material() {}
 
         virtual bool scatter(
-            const ray& r_in, const hit_record& rec, color& albedo, ray& scattered, double& pdf
+            const ray& r_in, const hit_record& rec, color& albedo, ray& scattered, double& pdf,
+            sampler& rng
         ) const {
             return false;
         }
@@ -41,6 +47,13 @@ class material {
         ) const {
             return color(0,0,0);
         }
+
+        // Materials that return true are followed along the ray scatter() produced and
+        // weighted by albedo alone, instead of being importance sampled towards the lights.
+        // That covers specular surfaces, whose pdf is a delta, and participating media.
+        virtual bool skip_pdf() const {
+            return false;
+        }
 };
 
 class lambertian : public material {
@@ -49,11 +62,12 @@ class lambertian : public material {
         lambertian(shared_ptr<texture> a) : albedo(a) {}
 
         virtual bool scatter(
-    const ray& r_in, const hit_record& rec, color& alb, ray& scattered, double& pdf
+            const ray& r_in, const hit_record& rec, color& alb, ray& scattered, double& pdf,
+            sampler& rng
         ) const override {
             onb uvw;
             uvw.build_from_w(rec.normal);
-            auto direction = uvw.local(random_cosine_direction());
+            auto direction = uvw.local(random_cosine_direction(rng));
             scattered = ray(rec.p, unit_vector(direction), r_in.time());
             alb = albedo->value(rec.u, rec.v, rec.p);
             pdf = dot(uvw.w(), scattered.direction()) / pi;
@@ -106,70 +120,79 @@ class lambertian : public material {
 // };
 
 
-// class metal : public material {
-//     public:
-//         metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+class metal : public material {
+    public:
+        metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
 
-//         virtual bool scatter(
-//             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-//         ) const override {
-//             vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-//             scattered = ray(rec.p, reflected + fuzz * random_in_unit_sphere(), r_in.time());
-//             attenuation = albedo;
-//             return (dot(scattered.direction(), rec.normal) > 0);
-//         }
+        virtual bool scatter(
+            const ray& r_in, const hit_record& rec, color& alb, ray& scattered, double& pdf,
+            sampler& rng
+        ) const override {
+            vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
+            scattered = ray(rec.p, reflected + fuzz * random_in_unit_sphere(rng), r_in.time());
+            alb = albedo;
+            pdf = 1;
+            return (dot(scattered.direction(), rec.normal) > 0);
+        }
 
-//     public:
-//         color albedo;
-//         double fuzz;
-// };
+        virtual bool skip_pdf() const override { return true; }
 
-// class dielectric : public material {
-//     public:
-//         dielectric(double index_of_refraction, shared_ptr<texture> a) : ir(index_of_refraction), albedo(a) {}
-//         dielectric(double index_of_refraction, const color & a) : ir(index_of_refraction), albedo(make_shared<solid_color>(a)) {}
-//         dielectric(double index_of_refraction) : ir(index_of_refraction) {}
+    public:
+        color albedo;
+        double fuzz;
+};
 
-//         virtual bool scatter(
-//             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-//         ) const override {
-//             attenuation = albedo->value(rec.u, rec.v, rec.p);
-//             double refraction_ratio = rec.front_face ? (1.0/ir) : ir;
+class dielectric : public material {
+    public:
+        dielectric(double index_of_refraction, shared_ptr<texture> a) : ir(index_of_refraction), albedo(a) {}
+        dielectric(double index_of_refraction, const color & a) : ir(index_of_refraction), albedo(make_shared<solid_color>(a)) {}
+        dielectric(double index_of_refraction) : ir(index_of_refraction), albedo(make_shared<solid_color>(1, 1, 1)) {}
 
-//             vec3 unit_direction = unit_vector(r_in.direction());
-//             double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
-//             double sin_theta = sqrt(1.0 - cos_theta*cos_theta);
+        virtual bool scatter(
+            const ray& r_in, const hit_record& rec, color& alb, ray& scattered, double& pdf,
+            sampler& rng
+        ) const override {
+            alb = albedo->value(rec.u, rec.v, rec.p);
+            pdf = 1;
+            double refraction_ratio = rec.front_face ? (1.0/ir) : ir;
 
-//             bool cannot_refract = refraction_ratio * sin_theta > 1.0;
-//             vec3 direction;
-//             if (cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double())
-//                 direction = reflect(unit_direction, rec.normal);
-//             else
-//                 direction = refract(unit_direction, rec.normal, refraction_ratio);
+            vec3 unit_direction = unit_vector(r_in.direction());
+            double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
+            double sin_theta = sqrt(1.0 - cos_theta*cos_theta);
 
-//             scattered = ray(rec.p, direction, r_in.time());
-//             return true;
-//         }
+            bool cannot_refract = refraction_ratio * sin_theta > 1.0;
+            vec3 direction;
+            if (cannot_refract || reflectance(cos_theta, refraction_ratio) > rng.random_double())
+                direction = reflect(unit_direction, rec.normal);
+            else
+                direction = refract(unit_direction, rec.normal, refraction_ratio);
 
-//     public:
-//         double ir; // Index of Refraction
-//         shared_ptr<texture> albedo;
+            scattered = ray(rec.p, direction, r_in.time());
+            return true;
+        }
 
-//     private:
-//         static double reflectance(double cosine, double ref_idx) {
-//             // Use Schlick's approximation for reflectance.
-//             auto r0 = (1-ref_idx) / (1+ref_idx);
-//             r0 = r0*r0;
-//             return r0 + (1-r0)*pow((1 - cosine),5);
-//         }
-// };
+        virtual bool skip_pdf() const override { return true; }
+
+    public:
+        double ir; // Index of Refraction
+        shared_ptr<texture> albedo;
+
+    private:
+        static double reflectance(double cosine, double ref_idx) {
+            // Use Schlick's approximation for reflectance.
+            auto r0 = (1-ref_idx) / (1+ref_idx);
+            r0 = r0*r0;
+            return r0 + (1-r0)*pow((1 - cosine),5);
+        }
+};
 
 class diffuse_light : public material  {
     public:
         diffuse_light(shared_ptr<texture> a) : emit(a) {}
         diffuse_light(color c) : emit(make_shared<solid_color>(c)) {}
         virtual bool scatter(
-            const ray& r_in, const hit_record& rec, color& albedo, ray& scattered, double& pdf
+            const ray& r_in, const hit_record& rec, color& albedo, ray& scattered, double& pdf,
+            sampler& rng
         ) const override {
             return false;
         }
@@ -185,22 +208,47 @@ class diffuse_light : public material  {
         shared_ptr<texture> emit;
 };
 
-// class isotropic : public material {
-//     public:
-//         isotropic(color c) : albedo(make_shared<solid_color>(c)) {}
-//         isotropic(shared_ptr<texture> a) : albedo(a) {}
+class isotropic : public material {
+    public:
+        isotropic(color c) : albedo(make_shared<solid_color>(c)) {}
+        isotropic(shared_ptr<texture> a) : albedo(a) {}
 
-//         virtual bool scatter(
-//             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-//         ) const override {
-//             scattered = ray(rec.p, random_in_unit_sphere(), r_in.time());
-//             attenuation = albedo->value(rec.u, rec.v, rec.p);
-//             return true;
-//         }
+        virtual bool scatter(
+            const ray& r_in, const hit_record& rec, color& alb, ray& scattered, double& pdf,
+            sampler& rng
+        ) const override {
+            scattered = ray(rec.p, random_unit_vector(rng), r_in.time());
+            alb = albedo->value(rec.u, rec.v, rec.p);
+            pdf = 1 / (4*pi);
+            return true;
+        }
 
-//     public:
-//         shared_ptr<texture> albedo;
-// };
+        virtual double scattering_pdf(
+            const ray& r_in, const hit_record& rec, const ray& scattered
+        ) const override {
+            return 1 / (4*pi);
+        }
+
+        virtual bool skip_pdf() const override { return true; }
+
+    public:
+        shared_ptr<texture> albedo;
+};
+
+// Owns the materials of one scene. Primitives and hit records refer to materials by plain
+// pointer, so recording a hit copies no reference count; the pointers stay valid for as
+// long as the table lives, even when the table itself is moved.
+class material_table {
+    public:
+        template <typename M, typename... Args>
+        const material* add(Args&&... args) {
+            materials.push_back(std::make_unique<M>(std::forward<Args>(args)...));
+            return materials.back().get();
+        }
+
+    private:
+        std::vector<std::unique_ptr<material>> materials;
+};
 
 // class cloud : public material {
 //     public:
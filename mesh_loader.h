@@ -0,0 +1,383 @@
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+//==============================================================================================
+// Triangle meshes from Wavefront OBJ and Stanford PLY files, for triangle_mesh.
+//
+// OBJ: "v X Y Z" vertices and "f" faces are read; a face's vertices may be written as
+// "i", "i/t", "i//n" or "i/t/n", and negative indices count back from the latest vertex.
+// Texture coordinates, normals, groups and materials are ignored.
+//
+// PLY: ascii, binary_little_endian and binary_big_endian. The vertex element's x, y and z
+// properties and the face element's vertex_indices (or vertex_index) list are read; every
+// other element and property is skipped.
+//
+// Polygons are split into triangle fans. Files are read in fixed-size blocks rather than
+// whole, so loading a multi-million-triangle model needs memory for the mesh and little
+// else.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class mesh_loader {
+    public:
+        // Loads filename, an .obj or .ply file, into positions (x, y, z per vertex) and
+        // indices (three per triangle). On failure prints "file:line: message" and
+        // returns false.
+        bool load(const char* filename, std::vector<float>& positions, std::vector<uint32_t>& indices) {
+            path = filename;
+            line_number = 0;
+            positions.clear();
+            indices.clear();
+
+            file = fopen(filename, "rb");
+            if (!file) {
+                std::cerr << "ERROR: Could not open mesh file '" << filename << "'.\n";
+                return false;
+            }
+            buffer.resize(block_size);
+            begin = end = 0;
+            eof = false;
+
+            auto extension = path.substr(path.find_last_of('.') + 1);
+            bool ok;
+            if (extension == "obj" || extension == "OBJ")
+                ok = load_obj(positions, indices);
+            else if (extension == "ply" || extension == "PLY")
+                ok = load_ply(positions, indices);
+            else
+                ok = fail("unknown mesh format (expected .obj or .ply)");
+
+            fclose(file);
+            std::vector<char>().swap(buffer);
+            if (!ok)
+                return false;
+
+            auto vertex_count = positions.size() / 3;
+            for (auto i : indices)
+                if (i >= vertex_count)
+                    return fail("face vertex index " + std::to_string(i) + " out of range ("
+                                + std::to_string(vertex_count) + " vertices)");
+            return true;
+        }
+
+    private:
+        static constexpr size_t block_size = 1 << 20;
+
+        std::string path;
+        int line_number;
+
+        FILE* file;
+        std::vector<char> buffer;
+        size_t begin, end;      // unread bytes in buffer
+        bool eof;
+
+        std::vector<std::string_view> tokens;
+        std::vector<uint32_t> polygon;
+
+        bool fail(const std::string& message) {
+            std::cerr << path << ":" << line_number << ": " << message << "\n";
+            return false;
+        }
+
+        // Moves the unread bytes to the front of the buffer and reads more after them,
+        // growing the buffer if a single line doesn't fit. Returns false at end of file.
+        bool refill() {
+            if (eof) return false;
+            if (begin > 0) {
+                std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+                end -= begin;
+                begin = 0;
+            }
+            if (end == buffer.size())
+                buffer.resize(buffer.size() * 2);
+            auto got = fread(buffer.data() + end, 1, buffer.size() - end, file);
+            end += got;
+            if (got == 0) eof = true;
+            return got > 0;
+        }
+
+        // The next line without its line ending. Returns false at end of file.
+        bool next_line(std::string_view& line) {
+            size_t scanned = 0;     // bytes past begin known not to hold a newline
+            for (;;) {
+                auto newline = static_cast<const char*>(
+                    std::memchr(buffer.data() + begin + scanned, '\n', end - begin - scanned));
+                if (newline) {
+                    size_t length = newline - (buffer.data() + begin);
+                    line = std::string_view(buffer.data() + begin, length);
+                    begin += length + 1;
+                    break;
+                }
+                scanned = end - begin;
+                if (!refill()) {
+                    if (begin == end) return false;
+                    line = std::string_view(buffer.data() + begin, end - begin);
+                    begin = end;
+                    break;
+                }
+            }
+            if (!line.empty() && line.back() == '\r')
+                line.remove_suffix(1);
+            line_number++;
+            return true;
+        }
+
+        bool read_bytes(void* out, size_t size) {
+            while (end - begin < size)
+                if (!refill()) return false;
+            std::memcpy(out, buffer.data() + begin, size);
+            begin += size;
+            return true;
+        }
+
+        void tokenize(std::string_view line) {
+            tokens.clear();
+            size_t i = 0;
+            while (i < line.size()) {
+                if (line[i] == ' ' || line[i] == '\t') { i++; continue; }
+                auto start = i;
+                while (i < line.size() && line[i] != ' ' && line[i] != '\t')
+                    i++;
+                tokens.push_back(line.substr(start, i - start));
+            }
+        }
+
+        template <typename T>
+        static bool parse(std::string_view token, T& out) {
+            auto first = token.data(), last = token.data() + token.size();
+            if (first != last && *first == '+') first++;
+            auto result = std::from_chars(first, last, out);
+            return result.ec == std::errc() && result.ptr == last;
+        }
+
+        bool load_obj(std::vector<float>& positions, std::vector<uint32_t>& indices) {
+            std::string_view line;
+            while (next_line(line)) {
+                tokenize(line);
+                if (tokens.empty() || tokens[0][0] == '#')
+                    continue;
+
+                if (tokens[0] == "v") {
+                    if (tokens.size() < 4)
+                        return fail("vertex needs three coordinates");
+                    for (int a = 1; a <= 3; a++) {
+                        float x;
+                        if (!parse(tokens[a], x))
+                            return fail("expected a number, got '" + std::string(tokens[a]) + "'");
+                        positions.push_back(x);
+                    }
+                } else if (tokens[0] == "f") {
+                    auto vertex_count = static_cast<long long>(positions.size() / 3);
+                    polygon.clear();
+                    for (size_t k = 1; k < tokens.size(); k++) {
+                        auto token = tokens[k].substr(0, tokens[k].find('/'));
+                        long long index;
+                        if (!parse(token, index) || index == 0)
+                            return fail("bad face vertex '" + std::string(tokens[k]) + "'");
+                        index = index < 0 ? vertex_count + index : index - 1;
+                        if (index < 0 || index >= vertex_count)
+                            return fail("face vertex '" + std::string(tokens[k]) + "' out of range");
+                        polygon.push_back(static_cast<uint32_t>(index));
+                    }
+                    if (!add_polygon(indices))
+                        return false;
+                }
+            }
+            return true;
+        }
+
+        bool add_polygon(std::vector<uint32_t>& indices) {
+            if (polygon.size() < 3)
+                return fail("face with fewer than three vertices");
+            for (size_t k = 2; k < polygon.size(); k++) {
+                indices.push_back(polygon[0]);
+                indices.push_back(polygon[k-1]);
+                indices.push_back(polygon[k]);
+            }
+            return true;
+        }
+
+        enum class ply_format { ascii, little_endian, big_endian };
+
+        enum ply_type { ply_int8, ply_uint8, ply_int16, ply_uint16, ply_int32, ply_uint32,
+                        ply_float32, ply_float64, ply_none };
+
+        struct ply_property {
+            std::string name;
+            ply_type type;
+            ply_type count_type = ply_none;     // set for list properties
+        };
+
+        struct ply_element {
+            std::string name;
+            uint64_t count;
+            std::vector<ply_property> properties;
+        };
+
+        ply_format format;
+        size_t token_cursor;
+
+        static ply_type parse_ply_type(std::string_view name) {
+            if (name == "char"   || name == "int8")    return ply_int8;
+            if (name == "uchar"  || name == "uint8")   return ply_uint8;
+            if (name == "short"  || name == "int16")   return ply_int16;
+            if (name == "ushort" || name == "uint16")  return ply_uint16;
+            if (name == "int"    || name == "int32")   return ply_int32;
+            if (name == "uint"   || name == "uint32")  return ply_uint32;
+            if (name == "float"  || name == "float32") return ply_float32;
+            if (name == "double" || name == "float64") return ply_float64;
+            return ply_none;
+        }
+
+        static size_t ply_size(ply_type type) {
+            static const size_t sizes[] = {1, 1, 2, 2, 4, 4, 4, 8};
+            return sizes[type];
+        }
+
+        // Reads one value of the given type, from the current line's tokens in ascii files
+        // and from the byte stream in binary ones.
+        bool ply_value(ply_type type, double& out) {
+            if (format == ply_format::ascii) {
+                if (token_cursor >= tokens.size())
+                    return fail("too few values");
+                if (!parse(tokens[token_cursor], out))
+                    return fail("expected a number, got '" + std::string(tokens[token_cursor]) + "'");
+                token_cursor++;
+                return true;
+            }
+
+            unsigned char bytes[8];
+            auto size = ply_size(type);
+            if (!read_bytes(bytes, size))
+                return fail("unexpected end of file");
+            uint64_t bits = 0;
+            for (size_t i = 0; i < size; i++)
+                bits |= uint64_t(bytes[i]) << 8 * (format == ply_format::little_endian ? i : size - 1 - i);
+
+            switch (type) {
+                case ply_int8:    out = static_cast<int8_t>(bits); break;
+                case ply_uint8:   out = static_cast<uint8_t>(bits); break;
+                case ply_int16:   out = static_cast<int16_t>(bits); break;
+                case ply_uint16:  out = static_cast<uint16_t>(bits); break;
+                case ply_int32:   out = static_cast<int32_t>(bits); break;
+                case ply_uint32:  out = static_cast<uint32_t>(bits); break;
+                case ply_float32: { auto word = static_cast<uint32_t>(bits); float x;
+                                    std::memcpy(&x, &word, 4); out = x; break; }
+                default:          { double x; std::memcpy(&x, &bits, 8); out = x; break; }
+            }
+            return true;
+        }
+
+        bool load_ply(std::vector<float>& positions, std::vector<uint32_t>& indices) {
+            std::vector<ply_element> elements;
+            std::string_view line;
+
+            if (!next_line(line) || line != "ply")
+                return fail("not a PLY file");
+
+            bool has_format = false;
+            for (;;) {
+                if (!next_line(line))
+                    return fail("missing end_header");
+                tokenize(line);
+                if (tokens.empty() || tokens[0] == "comment" || tokens[0] == "obj_info")
+                    continue;
+                if (tokens[0] == "end_header")
+                    break;
+
+                if (tokens[0] == "format" && tokens.size() >= 2) {
+                    if      (tokens[1] == "ascii")                format = ply_format::ascii;
+                    else if (tokens[1] == "binary_little_endian") format = ply_format::little_endian;
+                    else if (tokens[1] == "binary_big_endian")    format = ply_format::big_endian;
+                    else return fail("unknown PLY format '" + std::string(tokens[1]) + "'");
+                    has_format = true;
+                } else if (tokens[0] == "element" && tokens.size() == 3) {
+                    ply_element element;
+                    element.name = std::string(tokens[1]);
+                    if (!parse(tokens[2], element.count))
+                        return fail("bad element count '" + std::string(tokens[2]) + "'");
+                    elements.push_back(element);
+                } else if (tokens[0] == "property" && !elements.empty()) {
+                    ply_property property;
+                    if (tokens.size() == 5 && tokens[1] == "list") {
+                        property.count_type = parse_ply_type(tokens[2]);
+                        property.type = parse_ply_type(tokens[3]);
+                        if (property.count_type == ply_none)
+                            return fail("unknown PLY type '" + std::string(tokens[2]) + "'");
+                    } else if (tokens.size() == 3) {
+                        property.type = parse_ply_type(tokens[1]);
+                    } else {
+                        return fail("bad property");
+                    }
+                    if (property.type == ply_none)
+                        return fail("unknown PLY type in '" + std::string(line) + "'");
+                    property.name = std::string(tokens.back());
+                    elements.back().properties.push_back(property);
+                } else {
+                    return fail("unexpected '" + std::string(line) + "' in PLY header");
+                }
+            }
+            if (!has_format)
+                return fail("missing PLY format");
+
+            for (const auto& element : elements) {
+                bool is_vertex = element.name == "vertex", is_face = element.name == "face";
+                if (is_vertex)
+                    positions.reserve(3 * element.count);
+                if (is_face)
+                    indices.reserve(3 * element.count);
+
+                for (uint64_t k = 0; k < element.count; k++) {
+                    if (format == ply_format::ascii) {
+                        if (!next_line(line))
+                            return fail("unexpected end of file");
+                        tokenize(line);
+                        token_cursor = 0;
+                    }
+
+                    float xyz[3] = {0, 0, 0};
+                    for (const auto& property : element.properties) {
+                        double value;
+                        if (property.count_type != ply_none) {
+                            if (!ply_value(property.count_type, value))
+                                return false;
+                            bool indices_list = is_face && (property.name == "vertex_indices"
+                                                            || property.name == "vertex_index");
+                            polygon.clear();
+                            for (auto n = static_cast<uint64_t>(value); n > 0; n--) {
+                                double index;
+                                if (!ply_value(property.type, index))
+                                    return false;
+                                if (indices_list) {
+                                    if (index < 0)
+                                        return fail("negative vertex index");
+                                    polygon.push_back(static_cast<uint32_t>(index));
+                                }
+                            }
+                            if (indices_list && !add_polygon(indices))
+                                return false;
+                        } else {
+                            if (!ply_value(property.type, value))
+                                return false;
+                            if (is_vertex && property.name.size() == 1 && property.name[0] >= 'x'
+                                && property.name[0] <= 'z')
+                                xyz[property.name[0] - 'x'] = static_cast<float>(value);
+                        }
+                    }
+                    if (is_vertex)
+                        positions.insert(positions.end(), xyz, xyz + 3);
+                }
+            }
+            return true;
+        }
+};
+
+#endif
@@ -10,22 +10,28 @@ class moving_sphere : public hittable {
     public:
         moving_sphere() {}
         moving_sphere(
-            point3 cen0, point3 cen1, double _time0, double _time1, double r, shared_ptr<material> m)
+            point3 cen0, point3 cen1, double _time0, double _time1, double r, const material* m)
             : center0(cen0), center1(cen1), time0(_time0), time1(_time1), radius(r), mat_ptr(m)
         {};
 
         virtual bool hit(
             const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+
         virtual bool bounding_box(double _time0, double _time1, aabb& output_box) const override;
 
         point3 center(double time) const;
 
+    private:
+        // The nearest root of r's quadratic between t_min and t_max, if there is one.
+        bool nearest_root(const ray& r, double t_min, double t_max, double& root) const;
+
     public:
         point3 center0, center1;
         double time0, time1;
         double radius;
-        shared_ptr<material> mat_ptr;
+        const material* mat_ptr;
 };
 
 
@@ -46,10 +52,12 @@ bool moving_sphere::bounding_box(double _time0, double _time1, aabb& output_box)
 }
 
 
-bool moving_sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    vec3 oc = r.origin() - center(r.time());
-    auto a = r.direction().length_squared();
-    auto half_b = dot(oc, r.direction());
+bool moving_sphere::nearest_root(const ray& r, double t_min, double t_max, double& root) const {
+    // In double for the same reason as sphere::nearest_root().
+    dvec3 oc = dvec3(r.origin()) - dvec3(center(r.time()));
+    dvec3 direction(r.direction());
+    auto a = direction.length_squared();
+    auto half_b = dot(oc, direction);
     auto c = oc.length_squared() - radius*radius;
 
     auto discriminant = half_b*half_b - a*c;
@@ -57,12 +65,26 @@ bool moving_sphere::hit(const ray& r, double t_min, double t_max, hit_record& re
     auto sqrtd = sqrt(discriminant);
 
     // Find the nearest root that lies in the acceptable range.
-    auto root = (-half_b - sqrtd) / a;
+    root = (-half_b - sqrtd) / a;
     if (root < t_min || t_max < root) {
         root = (-half_b + sqrtd) / a;
         if (root < t_min || t_max < root)
             return false;
     }
+    return true;
+}
+
+
+bool moving_sphere::occluded(const ray& r, double t_min, double t_max) const {
+    double root;
+    return nearest_root(r, t_min, t_max, root);
+}
+
+
+bool moving_sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    double root;
+    if (!nearest_root(r, t_min, t_max, root))
+        return false;
 
     rec.t = root;
     rec.p = r.at(rec.t);
@@ -0,0 +1,331 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include "rtweekend.h"
+
+#include "adaptive.h"
+#include "scene.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Everything that can be set from the command line. Image and camera fields left at zero
+// (or unset) keep the value the scene was set up with.
+struct render_options {
+    std::string scene_name = "cornell_box";   // built-in scene name or scene file path
+    std::string output = "out";               // base name for out.jpg, out.pfm, ...
+    bool list_scenes = false;
+    bool show_help = false;
+    bool bench = false;                       // time ray casting instead of rendering
+
+    // Image
+    int image_width = 0;
+    int image_height = 0;
+    int samples_per_pixel = 0;
+    int max_depth = 0;
+    int roulette_bounces = 3;                 // bounces before Russian roulette may end a path
+
+    // Camera
+    bool set_lookfrom = false, set_lookat = false;
+    point3 lookfrom, lookat;
+    double vfov = 0.0;
+    double aperture = -1.0;
+    double focus_dist = 0.0;
+
+    // Rendering
+    int num_threads = std::max(1u, std::thread::hardware_concurrency());
+    int tile_size = 32;
+    uint64_t seed = 0;
+    adaptive_settings adaptive;
+    bool wavefront = false;                   // see wavefront.h
+    int wave_size = 1 << 14;                  // paths in flight per wavefront thread
+    int packet_size = 16;                     // camera rays traced together; 1 disables packets
+    int bvh_width = 8;                        // children per BVH node, see bvh.h
+
+    // Checkpointing (see checkpoint.h); the path defaults to <output>.ckpt.
+    std::string checkpoint_path;
+    double checkpoint_interval = 300.0; // seconds
+    bool resume = false;
+    std::string compare;                      // reference checkpoint to compare the render with
+
+    // Multi-process rendering (see distributed.h): "--workers N" makes this process a
+    // coordinator that runs N worker processes, "--worker DIR" makes it one of the workers.
+    // Workers get the same arguments as the coordinator, minus the coordinator-only ones.
+    int num_workers = 0;
+    int job_size = 128;
+    std::string job_dir;                      // defaults to <output>.jobs
+    std::string worker_dir;
+    std::vector<std::string> worker_argv;
+
+    std::string output_path(const char* suffix) const {
+        return output + suffix;
+    }
+
+    // Applies the image and camera overrides on top of the scene's own settings.
+    void apply_to(scene& s) const {
+        if (image_width > 0) {
+            if (image_height > 0) s.aspect_ratio = double(image_width) / image_height;
+            s.image_width = image_width;
+        } else if (image_height > 0) {
+            s.image_width = static_cast<int>(image_height * s.aspect_ratio);
+        }
+        if (samples_per_pixel > 0) s.samples_per_pixel = samples_per_pixel;
+        if (max_depth > 0) s.max_depth = max_depth;
+
+        if (set_lookfrom) s.lookfrom = lookfrom;
+        if (set_lookat) s.lookat = lookat;
+        if (vfov > 0.0) s.vfov = vfov;
+        if (aperture >= 0.0) s.aperture = aperture;
+        if (focus_dist > 0.0) s.focus_dist = focus_dist;
+    }
+
+    // The image height actually rendered. An explicit --height wins over the one derived
+    // from the aspect ratio so the two can't disagree by a rounding step.
+    int final_image_height(const scene& s) const {
+        return image_height > 0 ? image_height : s.image_height();
+    }
+};
+
+inline void print_usage(const char* program) {
+    std::cerr <<
+        "Usage: " << program << " [options]\n"
+        "\n"
+        "Scene:\n"
+        "  --scene NAME|FILE         built-in scene or scene file (default cornell_box)\n"
+        "  --list-scenes             list the built-in scenes and exit\n"
+        "  --bench                   time primary and secondary ray casts against the scene\n"
+        "                            at the image size and exit (see bench.h)\n"
+        "\n"
+        "Image (defaults come from the scene):\n"
+        "  --width PIXELS            image width\n"
+        "  --height PIXELS           image height; with --width this also sets the aspect ratio\n"
+        "  --spp N                   samples per pixel (the budget cap when adaptive)\n"
+        "  --depth N                 maximum path depth\n"
+        "  --rr-depth N              bounces before Russian roulette may end a path (default 3);\n"
+        "                            set it to the --depth value to turn roulette off\n"
+        "  --output BASE             write BASE.jpg, BASE.pfm, BASE.ckpt (default out)\n"
+        "\n"
+        "Camera (defaults come from the scene):\n"
+        "  --lookfrom X,Y,Z          camera position\n"
+        "  --lookat X,Y,Z            point the camera looks at\n"
+        "  --vfov DEGREES            vertical field of view\n"
+        "  --aperture A              lens aperture, 0 for a pinhole\n"
+        "  --focus-dist D            focus distance\n"
+        "\n"
+        "Rendering:\n"
+        "  --threads N               worker threads (default: all cores)\n"
+        "  --tile-size PIXELS        tile edge length (default 32)\n"
+        "  --seed N                  sampler seed (default 0)\n"
+        "  --wavefront               trace paths in batches, one stage at a time\n"
+        "  --wave-size N             paths per wavefront batch (default 16384)\n"
+        "  --packet-size 1|4|8|16    camera and shadow rays per SIMD packet in wavefront mode\n"
+        "                            (default 16)\n"
+        "  --bvh-width 2|4|8         children per BVH node (default 8)\n"
+        "  --adaptive                stop sampling pixels once their noise is below threshold\n"
+        "  --threshold T             relative error target for --adaptive (default 0.05)\n"
+        "  --min-spp N               samples before a pixel may stop early (default 32)\n"
+        "  --max-spp N               most samples any pixel may take (default 4096)\n"
+        "\n"
+        "Checkpoints:\n"
+        "  --checkpoint FILE         checkpoint path (default BASE.ckpt)\n"
+        "  --checkpoint-interval S   seconds between checkpoints (default 300)\n"
+        "  --resume                  continue from the checkpoint if it exists; one that can't\n"
+        "                            be read or has other render settings is an error\n"
+        "  --compare FILE            after rendering, report the time ratio to and the error\n"
+        "                            against the render checkpointed in FILE, e.g. the same\n"
+        "                            scene with another integrator or BVH width\n"
+        "\n"
+        "Multi-process:\n"
+        "  --workers N               coordinate N worker processes\n"
+        "  --job-dir DIR             shared job directory (default BASE.jobs)\n"
+        "  --job-size PIXELS         job tile edge length (default 128)\n"
+        "  --worker DIR              run as a worker on an existing job directory\n";
+}
+
+// Parses argv into opts. Prints a message and returns false on a malformed command line.
+inline bool parse_options(int argc, char* argv[], render_options& opts) {
+    opts.worker_argv = { argv[0] };
+
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        const char* value = nullptr;
+        bool forward = true;  // pass this option on to worker processes
+
+        auto take_value = [&]() {
+            if (a+1 >= argc) {
+                std::cerr << "ERROR: " << arg << " needs a value.\n";
+                return false;
+            }
+            value = argv[++a];
+            return true;
+        };
+        auto take_int = [&](int& out, int min) {
+            if (!take_value()) return false;
+            char* end;
+            long n = strtol(value, &end, 10);
+            if (*end != '\0' || n < min) {
+                std::cerr << "ERROR: " << arg << " expects an integer >= " << min << ", got '" << value << "'.\n";
+                return false;
+            }
+            out = static_cast<int>(n);
+            return true;
+        };
+        auto take_u64 = [&](uint64_t& out) {
+            if (!take_value()) return false;
+            char* end;
+            errno = 0;
+            unsigned long long n = strtoull(value, &end, 10);
+            if (end == value || *end != '\0' || errno == ERANGE || value[0] == '-') {
+                std::cerr << "ERROR: " << arg << " expects an unsigned 64-bit integer, got '" << value << "'.\n";
+                return false;
+            }
+            out = n;
+            return true;
+        };
+        auto take_double = [&](double& out) {
+            if (!take_value()) return false;
+            char* end;
+            out = strtod(value, &end);
+            if (*end != '\0') {
+                std::cerr << "ERROR: " << arg << " expects a number, got '" << value << "'.\n";
+                return false;
+            }
+            return true;
+        };
+        auto take_vec3 = [&](vec3& out) {
+            if (!take_value()) return false;
+            double x, y, z;
+            char extra;
+            if (sscanf(value, "%lf,%lf,%lf%c", &x, &y, &z, &extra) != 3) {
+                std::cerr << "ERROR: " << arg << " expects X,Y,Z, got '" << value << "'.\n";
+                return false;
+            }
+            out = vec3(x, y, z);
+            return true;
+        };
+
+        bool ok = true;
+        if (arg == "--help" || arg == "-h") {
+            opts.show_help = true;
+        } else if (arg == "--list-scenes") {
+            opts.list_scenes = true;
+        } else if (arg == "--bench") {
+            opts.bench = true;
+        } else if (arg == "--scene") {
+            ok = take_value();
+            if (ok) opts.scene_name = value;
+        } else if (arg == "--output") {
+            ok = take_value();
+            if (ok) opts.output = value;
+        } else if (arg == "--width") {
+            ok = take_int(opts.image_width, 1);
+        } else if (arg == "--height") {
+            ok = take_int(opts.image_height, 1);
+        } else if (arg == "--spp") {
+            ok = take_int(opts.samples_per_pixel, 1);
+        } else if (arg == "--depth") {
+            ok = take_int(opts.max_depth, 1);
+        } else if (arg == "--rr-depth") {
+            ok = take_int(opts.roulette_bounces, 0);
+        } else if (arg == "--lookfrom") {
+            ok = opts.set_lookfrom = take_vec3(opts.lookfrom);
+        } else if (arg == "--lookat") {
+            ok = opts.set_lookat = take_vec3(opts.lookat);
+        } else if (arg == "--vfov") {
+            ok = take_double(opts.vfov);
+        } else if (arg == "--aperture") {
+            ok = take_double(opts.aperture);
+        } else if (arg == "--focus-dist") {
+            ok = take_double(opts.focus_dist);
+        } else if (arg == "--threads") {
+            ok = take_int(opts.num_threads, 1);
+        } else if (arg == "--tile-size") {
+            ok = take_int(opts.tile_size, 1);
+        } else if (arg == "--seed") {
+            ok = take_u64(opts.seed);
+        } else if (arg == "--wavefront") {
+            opts.wavefront = true;
+        } else if (arg == "--wave-size") {
+            ok = take_int(opts.wave_size, 1);
+        } else if (arg == "--packet-size") {
+            ok = take_int(opts.packet_size, 1);
+            if (ok && opts.packet_size != 1 && opts.packet_size != 4 && opts.packet_size != 8 && opts.packet_size != 16) {
+                std::cerr << "ERROR: --packet-size must be 1, 4, 8 or 16.\n";
+                ok = false;
+            }
+        } else if (arg == "--bvh-width") {
+            ok = take_int(opts.bvh_width, 2);
+            if (ok && opts.bvh_width != 2 && opts.bvh_width != 4 && opts.bvh_width != 8) {
+                std::cerr << "ERROR: --bvh-width must be 2, 4 or 8.\n";
+                ok = false;
+            }
+        } else if (arg == "--adaptive") {
+            opts.adaptive.enabled = true;
+        } else if (arg == "--threshold") {
+            ok = take_double(opts.adaptive.threshold);
+        } else if (arg == "--min-spp") {
+            ok = take_int(opts.adaptive.min_spp, 1);
+        } else if (arg == "--max-spp") {
+            ok = take_int(opts.adaptive.max_spp, 1);
+        } else if (arg == "--checkpoint") {
+            ok = take_value();
+            if (ok) opts.checkpoint_path = value;
+            forward = false;
+        } else if (arg == "--checkpoint-interval") {
+            ok = take_double(opts.checkpoint_interval);
+            forward = false;
+        } else if (arg == "--resume") {
+            opts.resume = true;
+            forward = false;
+        } else if (arg == "--compare") {
+            ok = take_value();
+            if (ok) opts.compare = value;
+            forward = false;
+        } else if (arg == "--workers") {
+            ok = take_int(opts.num_workers, 1);
+            forward = false;
+        } else if (arg == "--job-dir") {
+            ok = take_value();
+            if (ok) opts.job_dir = value;
+            forward = false;
+        } else if (arg == "--job-size") {
+            ok = take_int(opts.job_size, 1);
+            forward = false;
+        } else if (arg == "--worker") {
+            ok = take_value();
+            if (ok) opts.worker_dir = value;
+            forward = false;
+        } else {
+            std::cerr << "ERROR: Unknown option '" << arg << "'. Try --help.\n";
+            return false;
+        }
+
+        if (!ok) return false;
+        if (forward) {
+            opts.worker_argv.push_back(arg);
+            if (value) opts.worker_argv.push_back(value);
+        }
+    }
+
+    if (!(opts.adaptive.threshold > 0)) {
+        std::cerr << "ERROR: --threshold must be greater than 0.\n";
+        return false;
+    }
+    if (opts.adaptive.min_spp > opts.adaptive.max_spp) {
+        std::cerr << "ERROR: --min-spp " << opts.adaptive.min_spp << " is more than --max-spp "
+                  << opts.adaptive.max_spp << ".\n";
+        return false;
+    }
+
+    if (opts.checkpoint_path.empty()) opts.checkpoint_path = opts.output_path(".ckpt");
+    if (opts.job_dir.empty()) opts.job_dir = opts.output_path(".jobs");
+    opts.worker_argv.push_back("--worker");
+    opts.worker_argv.push_back(opts.job_dir);
+    return true;
+}
+
+#endif
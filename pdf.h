@@ -6,12 +6,12 @@ class pdf {
         virtual ~pdf() {}
 
         virtual double value(const vec3& direction) const = 0;
-        virtual vec3 generate() const = 0;
+        virtual vec3 generate(sampler& rng) const = 0;
 };
 
-inline vec3 random_cosine_direction() {
-    auto r1 = random_double();
-    auto r2 = random_double();
+inline vec3 random_cosine_direction(sampler& rng) {
+    auto r1 = rng.random_double();
+    auto r2 = rng.random_double();
     auto z = sqrt(1-r2);
 
     auto phi = 2*pi*r1;
@@ -30,51 +30,54 @@ class cosine_pdf : public pdf {
             return (cosine <= 0) ? 0 : cosine/pi;
         }
 
-        virtual vec3 generate() const override {
-            return uvw.local(random_cosine_direction());
+        virtual vec3 generate(sampler& rng) const override {
+            return uvw.local(random_cosine_direction(rng));
         }
 
     public:
         onb uvw;
 };
 
+// Like cosine_pdf, hittable_pdf and mixture_pdf are value types meant to live on the stack
+// for one bounce. They refer to, rather than own, the hittable or pdfs they are built
+// from, so making one costs no allocation or reference count traffic.
 class hittable_pdf : public pdf {
     public:
-        hittable_pdf(shared_ptr<hittable> p, const point3& origin) : ptr(p), o(origin) {}
+        hittable_pdf(const hittable& p, const point3& origin) : ptr(&p), o(origin) {}
 
         virtual double value(const vec3& direction) const override {
             return ptr->pdf_value(o, direction);
         }
 
-        virtual vec3 generate() const override {
-            return ptr->random(o);
+        virtual vec3 generate(sampler& rng) const override {
+            return ptr->random(o, rng);
         }
 
     public:
+        const hittable* ptr;
         point3 o;
-        shared_ptr<hittable> ptr;
 };
 
 class mixture_pdf : public pdf {
     public:
-        mixture_pdf(shared_ptr<pdf> p0, shared_ptr<pdf> p1) {
-            p[0] = p0;
-            p[1] = p1;
+        mixture_pdf(const pdf& p0, const pdf& p1) {
+            p[0] = &p0;
+            p[1] = &p1;
         }
 
         virtual double value(const vec3& direction) const override {
             return 0.5 * p[0]->value(direction) + 0.5 *p[1]->value(direction);
         }
 
-        virtual vec3 generate() const override {
-            if (random_double() < 0.5)
-                return p[0]->generate();
+        virtual vec3 generate(sampler& rng) const override {
+            if (rng.random_double() < 0.5)
+                return p[0]->generate(rng);
             else
-                return p[1]->generate();
+                return p[1]->generate(rng);
         }
 
     public:
-        shared_ptr<pdf> p[2];
+        const pdf* p[2];
 };
 
 #endif
\ No newline at end of file
@@ -7,15 +7,19 @@
 
 class perlin {
     public:
-        perlin() {
+        // The tables come from their own generator, so a noise field depends only on its
+        // seed and not on how much of the global random stream scene setup has used.
+        perlin(uint64_t seed = 0x9e3779b97f4a7c15ULL) {
+            pcg32 gen(seed);
+
             ranvec = new vec3[point_count];
             for (int i = 0; i < point_count; ++i) {
-                ranvec[i] = unit_vector(vec3::random(-1,1));
+                ranvec[i] = unit_vector(vec3(gen.random_double(-1,1), gen.random_double(-1,1), gen.random_double(-1,1)));
             }
 
-            perm_x = perlin_generate_perm();
-            perm_y = perlin_generate_perm();
-            perm_z = perlin_generate_perm();
+            perm_x = perlin_generate_perm(gen);
+            perm_y = perlin_generate_perm(gen);
+            perm_z = perlin_generate_perm(gen);
         }
 
         ~perlin() {
@@ -67,20 +71,20 @@ class perlin {
         int* perm_y;
         int* perm_z;
 
-        static int* perlin_generate_perm() {
+        static int* perlin_generate_perm(pcg32& gen) {
             auto p = new int[point_count];
 
             for (int i = 0; i < point_count; i++)
                 p[i] = i;
 
-            permute(p, point_count);
+            permute(p, point_count, gen);
 
             return p;
         }
 
-        static void permute(int* p, int n) {
+        static void permute(int* p, int n, pcg32& gen) {
             for (int i = n-1; i > 0; i--) {
-                int target = random_int(0,i);
+                int target = gen.random_int(0,i);
                 int tmp = p[i];
                 p[i] = p[target];
                 p[target] = tmp;
@@ -15,10 +15,45 @@ class ray {
         point3 at(double t) const {
             return orig + t*dir;
         }
+
+        // This ray's time and medium sample from another origin in another direction, for
+        // hittables that carry rays into an object's own space.
+        ray moved(const point3& origin, const vec3& direction) const {
+            ray r(origin, direction, tm);
+            r.medium_rng = medium_rng;
+            r.medium_dimension = medium_dimension;
+            return r;
+        }
+
+        // Reserves a dimension of the path's sampler for the participating media the ray
+        // passes through (see constant_medium), whose hit() has no sampler to draw from.
+        void sample_media(sampler& rng) {
+            medium_rng = &rng;
+            medium_dimension = rng.reserve_dimension();
+        }
+
     public:
         vec3 orig;
         vec3 dir;
         double tm;
+        const sampler* medium_rng = nullptr;    // none for rays that aren't part of a path
+        uint32_t medium_dimension = 0;
+};
+
+
+// A ray prepared for slab tests against many boxes: the reciprocal of its direction, and
+// per axis the index (0 for the min corner, 1 for the max corner) of the slab plane the ray
+// enters through. Acceleration structures build one per traversal instead of dividing for
+// every box they test.
+struct traversal_ray {
+    point3 origin;
+    vec3 inv_dir;
+    int sign[3];
+
+    explicit traversal_ray(const ray& r)
+        : origin(r.orig), inv_dir(1.0 / r.dir.x(), 1.0 / r.dir.y(), 1.0 / r.dir.z()),
+          sign{inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0}
+    {}
 };
 
 
@@ -0,0 +1,55 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "ray.h"
+#include "simd.h"
+
+#include <cstdint>
+
+// A bundle of up to max_size rays traced through the scene together (see
+// hittable::hit_packet). Components are stored structure-of-arrays so one SIMD register
+// holds the same component of vdouble::width neighbouring lanes. Lane l of the packet is
+// live when bit l of the caller's active mask is set; everything past size is padding that
+// SIMD code may read but whose results are masked off.
+struct ray_packet {
+    static constexpr int max_size = 16;
+
+    int size = 0;
+    alignas(32) double ox[max_size] = {}, oy[max_size] = {}, oz[max_size] = {};
+    alignas(32) double dx[max_size] = {}, dy[max_size] = {}, dz[max_size] = {};
+    alignas(32) double inv_dx[max_size] = {}, inv_dy[max_size] = {}, inv_dz[max_size] = {};
+    alignas(32) double time[max_size] = {};
+    const sampler* medium_rng[max_size] = {};
+    uint32_t medium_dimension[max_size] = {};
+
+    void clear() { size = 0; }
+
+    // Appends r as the next lane and returns its index.
+    int add(const ray& r) {
+        int l = size++;
+        ox[l] = r.orig.x(); oy[l] = r.orig.y(); oz[l] = r.orig.z();
+        dx[l] = r.dir.x();  dy[l] = r.dir.y();  dz[l] = r.dir.z();
+        inv_dx[l] = 1.0 / dx[l]; inv_dy[l] = 1.0 / dy[l]; inv_dz[l] = 1.0 / dz[l];
+        time[l] = r.tm;
+        medium_rng[l] = r.medium_rng;
+        medium_dimension[l] = r.medium_dimension;
+        return l;
+    }
+
+    ray get(int l) const {
+        ray r(point3(ox[l], oy[l], oz[l]), vec3(dx[l], dy[l], dz[l]), time[l]);
+        r.medium_rng = medium_rng[l];
+        r.medium_dimension = medium_dimension[l];
+        return r;
+    }
+
+    // Lanes [l, l + vdouble::width) of the origins and directions, l a multiple of the width.
+    vvec3 origins(int l) const { return vvec3::load(ox + l, oy + l, oz + l); }
+    vvec3 directions(int l) const { return vvec3::load(dx + l, dy + l, dz + l); }
+
+    uint32_t all_lanes() const {
+        return size >= 32 ? ~0u : (1u << size) - 1;
+    }
+};
+
+#endif
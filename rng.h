@@ -0,0 +1,140 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+// PCG32 (O'Neill 2014): a small, fast sequential generator. Used for one-off work such as
+// scene construction and noise tables, where a plain stream of numbers is all we need.
+class pcg32 {
+    public:
+        pcg32(uint64_t seed = 0x853c49e6748fea9bULL, uint64_t stream = 0xda3e39cb94b95bdbULL) {
+            set_seed(seed, stream);
+        }
+
+        void set_seed(uint64_t seed, uint64_t stream = 0xda3e39cb94b95bdbULL) {
+            state = 0;
+            inc = (stream << 1) | 1;
+            next_u32();
+            state += seed;
+            next_u32();
+        }
+
+        uint32_t next_u32() {
+            uint64_t old = state;
+            state = old * 6364136223846793005ULL + inc;
+            uint32_t xorshifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+            uint32_t rot = static_cast<uint32_t>(old >> 59);
+            return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+        }
+
+        double random_double() {
+            // Returns a random real in [0,1).
+            return next_u32() * 0x1p-32;
+        }
+
+        double random_double(double min, double max) {
+            return min + (max-min)*random_double();
+        }
+
+        int random_int(int min, int max) {
+            // Returns a random integer in [min,max].
+            return static_cast<int>(random_double(min, max+1));
+        }
+
+    private:
+        uint64_t state;
+        uint64_t inc;
+};
+
+// Counter-based generator for the render hot path, built on Philox4x32-10 (Salmon et al.
+// 2011). Every number is a pure function of (seed, pixel, sample, dimension), so a pixel's
+// samples do not depend on which thread renders it or on what was drawn before, and the
+// only state to save to resume a pixel is its sample index.
+class sampler {
+    public:
+        sampler(uint64_t seed, int i, int j)
+            : key0(static_cast<uint32_t>(seed)), key1(static_cast<uint32_t>(seed >> 32)),
+              px(static_cast<uint32_t>(i)), py(static_cast<uint32_t>(j)) {
+            start_sample(0);
+        }
+
+        // Positions the stream at the first dimension of the given sample.
+        void start_sample(uint32_t index) {
+            sample = index;
+            dimension = 0;
+        }
+
+        uint32_t sample_index() const { return sample; }
+
+        uint32_t next_u32() {
+            if ((dimension & 3) == 0)
+                philox(dimension >> 2);
+            return block[dimension++ & 3];
+        }
+
+        double random_double() {
+            // Returns a random real in [0,1).
+            return next_u32() * 0x1p-32;
+        }
+
+        double random_double(double min, double max) {
+            return min + (max-min)*random_double();
+        }
+
+        // Skips the next dimension and returns its index, for code that can't be handed the
+        // sampler itself to draw with random_double_at() later (see ray::sample_media()).
+        uint32_t reserve_dimension() {
+            next_u32();
+            return dimension - 1;
+        }
+
+        // The number at dimension d of the current sample in another stream of the same
+        // pixel, without moving this stream's position. Streams are told apart by the key,
+        // so each stream > 0 is independent of the main one and of the others.
+        double random_double_at(uint32_t d, uint32_t stream) const {
+            uint32_t out[4];
+            philox(d >> 2, key0 ^ (stream * 0x9E3779B9u), key1, out);
+            return out[d & 3] * 0x1p-32;
+        }
+
+    private:
+        uint32_t key0, key1;
+        uint32_t px, py;
+        uint32_t sample;
+        uint32_t dimension;
+        uint32_t block[4];
+
+        static void mulhilo(uint32_t a, uint32_t b, uint32_t& hi, uint32_t& lo) {
+            uint64_t product = uint64_t(a) * uint64_t(b);
+            hi = static_cast<uint32_t>(product >> 32);
+            lo = static_cast<uint32_t>(product);
+        }
+
+        void philox(uint32_t n) {
+            philox(n, key0, key1, block);
+        }
+
+        // The four outputs for counter (n, sample, px, py) under key (k0, k1).
+        void philox(uint32_t n, uint32_t k0, uint32_t k1, uint32_t out[4]) const {
+            uint32_t c0 = n, c1 = sample, c2 = px, c3 = py;
+
+            for (int round = 0; round < 10; round++) {
+                uint32_t hi0, lo0, hi1, lo1;
+                mulhilo(0xD2511F53u, c0, hi0, lo0);
+                mulhilo(0xCD9E8D57u, c2, hi1, lo1);
+                c0 = hi1 ^ c1 ^ k0;
+                c1 = lo1;
+                c2 = hi0 ^ c3 ^ k1;
+                c3 = lo0;
+                k0 += 0x9E3779B9u;
+                k1 += 0xBB67AE85u;
+            }
+
+            out[0] = c0;
+            out[1] = c1;
+            out[2] = c2;
+            out[3] = c3;
+        }
+};
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef ROULETTE_H
+#define ROULETTE_H
+
+#include "rtweekend.h"
+
+#include <algorithm>
+
+// Russian roulette path termination. Past the first few bounces a path continues with
+// probability equal to its largest throughput component, capped so every path eventually
+// ends, and a surviving path's weight is divided by that probability so the estimate
+// stays unbiased. Dim paths, which contribute little, end early; max_depth remains as a
+// hard limit.
+//
+// depth is the remaining depth of the ray that was just scattered (ray_color()'s depth
+// argument) and roulette_depth is the depth at and below which roulette applies, i.e.
+// max_depth minus the number of bounces every path is guaranteed. Returns 1 when roulette
+// does not apply.
+inline double survival_probability(const color& throughput, int depth, int roulette_depth) {
+    if (depth > roulette_depth)
+        return 1.0;
+    return std::min<double>(std::max({throughput.x(), throughput.y(), throughput.z()}), 0.95);
+}
+
+#endif
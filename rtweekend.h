@@ -2,10 +2,13 @@
 #define RTWEEKEND_H
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <limits>
 #include <memory>
 
+#include "rng.h"
+
 
 // Usings
 
@@ -24,9 +27,20 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
+inline pcg32& random_engine() {
+    // Each thread draws from its own generator, so nothing here is shared between threads.
+    // The render loop itself uses a per-pixel sampler (see rng.h) instead.
+    thread_local pcg32 engine;
+    return engine;
+}
+
+inline void seed_random(uint64_t seed) {
+    random_engine().set_seed(seed);
+}
+
 inline double random_double() {
     // Returns a random real in [0,1).
-    return rand() / (RAND_MAX + 1.0);
+    return random_engine().random_double();
 }
 
 inline double random_double(double min, double max) {
@@ -0,0 +1,50 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "hittable_list.h"
+#include "material.h"
+
+// Everything needed to render one image: the geometry, the lights to importance sample,
+// the camera, and the render settings the scene was set up for. Scene files (see
+// scene_loader.h) produce one of these, as do the built-in scene functions. The scene owns
+// its materials; everything in world refers into materials.
+struct scene {
+    material_table materials;
+    hittable_list world;
+    shared_ptr<hittable> lights;   // sampled by the integrator; may be null
+    color background = color(0,0,0);
+
+    // Sampler streams handed to the scene's participating media (see constant_medium),
+    // numbered per scene so a medium's noise depends only on the scene it is in. Stream 0
+    // is the path's own.
+    uint32_t medium_streams = 0;
+    uint32_t next_medium_stream() { return ++medium_streams; }
+
+    // Camera
+    point3 lookfrom = point3(0,0,0);
+    point3 lookat = point3(0,0,-1);
+    vec3 vup = vec3(0,1,0);
+    double vfov = 40.0;
+    double aperture = 0.0;
+    double focus_dist = 10.0;
+    double time0 = 0.0, time1 = 1.0;
+
+    // Image
+    double aspect_ratio = 1.0;
+    int image_width = 600;
+    int samples_per_pixel = 100;
+    int max_depth = 50;
+
+    int image_height() const {
+        return static_cast<int>(image_width / aspect_ratio);
+    }
+
+    camera make_camera() const {
+        return camera(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, focus_dist, time0, time1);
+    }
+};
+
+#endif
@@ -0,0 +1,605 @@
+#ifndef SCENE_LOADER_H
+#define SCENE_LOADER_H
+//==============================================================================================
+// Scene description files.
+//
+// One statement per line; '#' starts a comment. Names are bare words, file names are
+// double-quoted, and a COLOR is three numbers "R G B".
+//
+//   camera [lookfrom X Y Z] [lookat X Y Z] [vup X Y Z] [vfov DEG] [aperture A] [focus D]
+//          [time T0 T1]
+//   image [width W] [aspect A] [spp N] [depth N]
+//   background COLOR
+//
+//   texture NAME solid COLOR
+//   texture NAME checker TEX TEX
+//   texture NAME noise SCALE
+//   texture NAME bubble SCALE
+//   texture NAME image "FILE"
+//
+//   material NAME lambertian TEX
+//   material NAME metal COLOR FUZZ
+//   material NAME dielectric IOR [TEX]
+//   material NAME diffuse_light TEX
+//   material NAME isotropic TEX
+//
+// where TEX is either a texture name or an inline COLOR.
+//
+// Objects are added to the current group, which is the world at top level. Writing
+// "NAME = " in front of an object statement names it instead, so it can be wrapped,
+// instanced with add, or used as a light later on.
+//
+//   sphere X Y Z RADIUS MAT
+//   moving_sphere X0 Y0 Z0 X1 Y1 Z1 T0 T1 RADIUS MAT
+//   xy_rect X0 X1 Y0 Y1 K MAT
+//   xz_rect X0 X1 Z0 Z1 K MAT
+//   yz_rect Y0 Y1 Z0 Z1 K MAT
+//   box X0 Y0 Z0 X1 Y1 Z1 MAT
+//   mesh "FILE" MAT         a triangle mesh from an .obj or .ply file (see mesh_loader.h)
+//   translate OBJ DX DY DZ
+//   rotate_y OBJ DEGREES
+//   flip_face OBJ
+//   instance OBJ [translate DX DY DZ] [rotate AX AY AZ DEGREES] [scale S | scale SX SY SZ]
+//   constant_medium OBJ DENSITY TEX
+//   bvh GROUP [leaf N] [bins N] [traversal COST] [intersection COST] [threads N] [width 2|4|8]
+//   sphere_set GROUP        the spheres of GROUP packed into one sphere_set (see sphere_set.h)
+//
+//   add OBJ                 adds a named object to the current group
+//   group NAME ... end      collects the objects in between into a list called NAME
+//   light OBJ               importance-samples OBJ as a light; OBJ should be the object
+//                           that is in the world, flipped the same way, since light
+//                           samples are shaded with its material
+//
+// instance places OBJ under the transform its steps build, applied in the order written,
+// and shares OBJ with every other instance of it rather than copying it. Instancing a bvh
+// and putting a bvh over the instances gives a two-level hierarchy.
+//
+// The parser works on the whole file in memory and splits each line into views of it
+// rather than copies, so files with hundreds of thousands of objects load in a fraction of
+// a second.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "aarect.h"
+#include "box.h"
+#include "bvh.h"
+#include "constant_medium.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "material.h"
+#include "mesh_loader.h"
+#include "moving_sphere.h"
+#include "scene.h"
+#include "sphere.h"
+#include "sphere_set.h"
+#include "texture.h"
+#include "triangle_mesh.h"
+
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class scene_loader {
+    public:
+        // Loads filename into out. On failure prints "file:line: message" and returns false.
+        // Without geometry only the camera, image and background statements are run, and
+        // the rest of the file is not checked.
+        bool load(const char* filename, scene& out, bool geometry = true) {
+            path = filename;
+            line_number = 0;
+            load_geometry = geometry;
+
+            std::string text;
+            if (!read_all(filename, text)) {
+                std::cerr << "ERROR: Could not open scene file '" << filename << "'.\n";
+                return false;
+            }
+
+            out = scene();
+            result = &out;
+            groups.assign(1, &out.world);
+
+            size_t pos = 0;
+            while (pos < text.size()) {
+                auto eol = text.find('\n', pos);
+                if (eol == std::string::npos) eol = text.size();
+                line_number++;
+
+                if (!tokenize(std::string_view(text).substr(pos, eol - pos)))
+                    return false;
+                if (!tokens.empty() && !statement())
+                    return false;
+
+                pos = eol + 1;
+            }
+
+            if (groups.size() != 1)
+                return fail("missing 'end' for group");
+
+            if (light_list.objects.size() == 1)
+                out.lights = light_list.objects[0];
+            else if (!light_list.objects.empty())
+                out.lights = make_shared<hittable_list>(light_list);
+
+            return true;
+        }
+
+    private:
+        std::string path;
+        int line_number;
+        bool load_geometry;
+        scene* result;
+
+        std::vector<std::string_view> tokens;
+        size_t cursor;
+
+        std::unordered_map<std::string, shared_ptr<texture>> textures;
+        std::unordered_map<std::string, const material*> materials;
+        std::unordered_map<std::string, shared_ptr<hittable>> objects;
+        std::unordered_map<std::string, shared_ptr<hittable_list>> group_lists;
+        std::vector<hittable_list*> groups;
+        hittable_list light_list;
+
+        bool fail(const std::string& message) {
+            std::cerr << path << ":" << line_number << ": " << message << "\n";
+            return false;
+        }
+
+        static bool read_all(const char* filename, std::string& text) {
+            FILE* f = fopen(filename, "rb");
+            if (!f) return false;
+            fseek(f, 0, SEEK_END);
+            auto size = ftell(f);
+            fseek(f, 0, SEEK_SET);
+            text.resize(size > 0 ? size : 0);
+            bool ok = fread(&text[0], 1, text.size(), f) == text.size();
+            fclose(f);
+            return ok;
+        }
+
+        // Splits one line into tokens, dropping comments. Quoted strings become a single
+        // token without their quotes.
+        bool tokenize(std::string_view line) {
+            tokens.clear();
+            cursor = 0;
+
+            size_t i = 0;
+            while (i < line.size()) {
+                char c = line[i];
+                if (c == '#') break;
+                if (c == ' ' || c == '\t' || c == '\r') { i++; continue; }
+
+                if (c == '"') {
+                    auto close = line.find('"', i + 1);
+                    if (close == std::string_view::npos)
+                        return fail("unterminated string");
+                    tokens.push_back(line.substr(i + 1, close - i - 1));
+                    i = close + 1;
+                    continue;
+                }
+
+                auto start = i;
+                while (i < line.size() && line[i] != ' ' && line[i] != '\t' && line[i] != '\r' && line[i] != '#')
+                    i++;
+                tokens.push_back(line.substr(start, i - start));
+            }
+            return true;
+        }
+
+        bool at_end() const { return cursor >= tokens.size(); }
+
+        bool word(std::string_view& out) {
+            if (at_end()) return fail("unexpected end of line");
+            out = tokens[cursor++];
+            return true;
+        }
+
+        bool peek_number() const {
+            if (at_end()) return false;
+            char c = tokens[cursor][0];
+            return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.';
+        }
+
+        bool number(double& out) {
+            if (at_end()) return fail("expected a number");
+            auto t = tokens[cursor];
+            auto first = t.data();
+            if (*first == '+') first++;
+            auto result = std::from_chars(first, t.data() + t.size(), out);
+            if (result.ec != std::errc() || result.ptr != t.data() + t.size())
+                return fail("expected a number, got '" + std::string(t) + "'");
+            cursor++;
+            return true;
+        }
+
+        bool integer(int& out) {
+            double value;
+            if (!number(value)) return false;
+            out = static_cast<int>(value);
+            return true;
+        }
+
+        bool positive_number(double& out) {
+            double value;
+            if (!number(value)) return false;
+            if (!(value > 0) || !std::isfinite(value))
+                return fail("expected a positive number, got '" + std::string(tokens[cursor-1]) + "'");
+            out = value;
+            return true;
+        }
+
+        bool positive_integer(int& out) {
+            double value;
+            if (!number(value)) return false;
+            if (!(value >= 1) || value > std::numeric_limits<int>::max())
+                return fail("expected a positive integer, got '" + std::string(tokens[cursor-1]) + "'");
+            out = static_cast<int>(value);
+            return true;
+        }
+
+        bool vector(vec3& out) {
+            double x, y, z;
+            if (!number(x) || !number(y) || !number(z)) return false;
+            out = vec3(x, y, z);
+            return true;
+        }
+
+        bool texture_ref(shared_ptr<texture>& out) {
+            if (peek_number()) {
+                color c;
+                if (!vector(c)) return false;
+                out = make_shared<solid_color>(c);
+                return true;
+            }
+            std::string_view name;
+            if (!word(name)) return false;
+            auto found = textures.find(std::string(name));
+            if (found == textures.end())
+                return fail("unknown texture '" + std::string(name) + "'");
+            out = found->second;
+            return true;
+        }
+
+        bool material_ref(const material*& out) {
+            std::string_view name;
+            if (!word(name)) return false;
+            auto found = materials.find(std::string(name));
+            if (found == materials.end())
+                return fail("unknown material '" + std::string(name) + "'");
+            out = found->second;
+            return true;
+        }
+
+        bool object_ref(shared_ptr<hittable>& out) {
+            std::string_view name;
+            if (!word(name)) return false;
+            auto found = objects.find(std::string(name));
+            if (found == objects.end())
+                return fail("unknown object '" + std::string(name) + "'");
+            out = found->second;
+            return true;
+        }
+
+        bool finish() {
+            if (!at_end())
+                return fail("unexpected '" + std::string(tokens[cursor]) + "'");
+            return true;
+        }
+
+        bool statement() {
+            std::string_view command;
+            word(command);
+
+            if (command == "camera")     return camera_statement();
+            if (command == "image")      return image_statement();
+            if (command == "background") return vector(result->background) && finish();
+            if (!load_geometry)          return true;
+            if (command == "texture")    return texture_statement();
+            if (command == "material")   return material_statement();
+
+            if (command == "group") {
+                std::string_view name;
+                if (!word(name) || !finish()) return false;
+                auto list = make_shared<hittable_list>();
+                group_lists[std::string(name)] = list;
+                objects[std::string(name)] = list;
+                groups.push_back(list.get());
+                return true;
+            }
+
+            if (command == "end") {
+                if (groups.size() == 1) return fail("'end' without 'group'");
+                groups.pop_back();
+                return finish();
+            }
+
+            if (command == "light") {
+                shared_ptr<hittable> object;
+                if (!object_ref(object) || !finish()) return false;
+                light_list.add(object);
+                return true;
+            }
+
+            if (command == "add") {
+                shared_ptr<hittable> object;
+                if (!object_ref(object) || !finish()) return false;
+                groups.back()->add(object);
+                return true;
+            }
+
+            // Object statements, optionally named: "NAME = shape ..."
+            std::string_view name;
+            if (!at_end() && tokens[cursor] == "=") {
+                name = command;
+                cursor++;
+                if (!word(command)) return false;
+            }
+
+            shared_ptr<hittable> object;
+            if (!object_statement(command, object) || !finish())
+                return false;
+
+            if (name.empty())
+                groups.back()->add(object);
+            else
+                objects[std::string(name)] = object;
+            return true;
+        }
+
+        bool camera_statement() {
+            while (!at_end()) {
+                std::string_view key;
+                word(key);
+                bool ok;
+                if      (key == "lookfrom") ok = vector(result->lookfrom);
+                else if (key == "lookat")   ok = vector(result->lookat);
+                else if (key == "vup")      ok = vector(result->vup);
+                else if (key == "vfov")     ok = number(result->vfov);
+                else if (key == "aperture") ok = number(result->aperture);
+                else if (key == "focus")    ok = number(result->focus_dist);
+                else if (key == "time")     ok = number(result->time0) && number(result->time1);
+                else return fail("unknown camera setting '" + std::string(key) + "'");
+                if (!ok) return false;
+            }
+            return true;
+        }
+
+        bool image_statement() {
+            while (!at_end()) {
+                std::string_view key;
+                word(key);
+                bool ok;
+                if      (key == "width")  ok = positive_integer(result->image_width);
+                else if (key == "aspect") ok = positive_number(result->aspect_ratio);
+                else if (key == "spp")    ok = positive_integer(result->samples_per_pixel);
+                else if (key == "depth")  ok = positive_integer(result->max_depth);
+                else return fail("unknown image setting '" + std::string(key) + "'");
+                if (!ok) return false;
+            }
+            if (result->image_height() <= 0)
+                return fail("width and aspect give an image less than one pixel high");
+            return true;
+        }
+
+        bool texture_statement() {
+            std::string_view name, type;
+            if (!word(name) || !word(type)) return false;
+
+            shared_ptr<texture> tex;
+            if (type == "solid") {
+                color c;
+                if (!vector(c)) return false;
+                tex = make_shared<solid_color>(c);
+            } else if (type == "checker") {
+                shared_ptr<texture> even, odd;
+                if (!texture_ref(even) || !texture_ref(odd)) return false;
+                tex = make_shared<checker_texture>(even, odd);
+            } else if (type == "noise" || type == "bubble") {
+                double scale;
+                if (!number(scale)) return false;
+                if (type == "noise")
+                    tex = make_shared<noise_texture>(scale);
+                else
+                    tex = make_shared<bubble_texture>(scale);
+            } else if (type == "image") {
+                std::string_view file;
+                if (!word(file)) return false;
+                tex = make_shared<image_texture>(std::string(file).c_str());
+            } else {
+                return fail("unknown texture type '" + std::string(type) + "'");
+            }
+
+            textures[std::string(name)] = tex;
+            return finish();
+        }
+
+        bool material_statement() {
+            std::string_view name, type;
+            if (!word(name) || !word(type)) return false;
+
+            auto& table = result->materials;
+            const material* mat;
+            shared_ptr<texture> tex;
+            if (type == "lambertian") {
+                if (!texture_ref(tex)) return false;
+                mat = table.add<lambertian>(tex);
+            } else if (type == "metal") {
+                color albedo;
+                double fuzz;
+                if (!vector(albedo) || !number(fuzz)) return false;
+                mat = table.add<metal>(albedo, fuzz);
+            } else if (type == "dielectric") {
+                double ir;
+                if (!number(ir)) return false;
+                if (at_end())
+                    mat = table.add<dielectric>(ir);
+                else if (!texture_ref(tex))
+                    return false;
+                else
+                    mat = table.add<dielectric>(ir, tex);
+            } else if (type == "diffuse_light") {
+                if (!texture_ref(tex)) return false;
+                mat = table.add<diffuse_light>(tex);
+            } else if (type == "isotropic") {
+                if (!texture_ref(tex)) return false;
+                mat = table.add<isotropic>(tex);
+            } else {
+                return fail("unknown material type '" + std::string(type) + "'");
+            }
+
+            materials[std::string(name)] = mat;
+            return finish();
+        }
+
+        bool object_statement(std::string_view type, shared_ptr<hittable>& out) {
+            const material* mat;
+
+            if (type == "sphere") {
+                point3 center;
+                double radius;
+                if (!vector(center) || !number(radius) || !material_ref(mat)) return false;
+                out = make_shared<sphere>(center, radius, mat);
+            } else if (type == "moving_sphere") {
+                point3 center0, center1;
+                double t0, t1, radius;
+                if (!vector(center0) || !vector(center1) || !number(t0) || !number(t1)
+                    || !number(radius) || !material_ref(mat))
+                    return false;
+                out = make_shared<moving_sphere>(center0, center1, t0, t1, radius, mat);
+            } else if (type == "xy_rect" || type == "xz_rect" || type == "yz_rect") {
+                double a0, a1, b0, b1, k;
+                if (!number(a0) || !number(a1) || !number(b0) || !number(b1) || !number(k)
+                    || !material_ref(mat))
+                    return false;
+                if (type == "xy_rect")
+                    out = make_shared<xy_rect>(a0, a1, b0, b1, k, mat);
+                else if (type == "xz_rect")
+                    out = make_shared<xz_rect>(a0, a1, b0, b1, k, mat);
+                else
+                    out = make_shared<yz_rect>(a0, a1, b0, b1, k, mat);
+            } else if (type == "box") {
+                point3 p0, p1;
+                if (!vector(p0) || !vector(p1) || !material_ref(mat)) return false;
+                out = make_shared<box>(p0, p1, mat);
+            } else if (type == "mesh") {
+                std::string_view file;
+                if (!word(file) || !material_ref(mat)) return false;
+                std::vector<float> positions;
+                std::vector<uint32_t> indices;
+                if (!mesh_loader().load(std::string(file).c_str(), positions, indices))
+                    return fail("could not load mesh '" + std::string(file) + "'");
+                if (indices.empty())
+                    return fail("mesh '" + std::string(file) + "' has no faces");
+                out = make_shared<triangle_mesh>(std::move(positions), std::move(indices), mat);
+            } else if (type == "translate") {
+                shared_ptr<hittable> object;
+                vec3 offset;
+                if (!object_ref(object) || !vector(offset)) return false;
+                out = make_shared<translate>(object, offset);
+            } else if (type == "rotate_y") {
+                shared_ptr<hittable> object;
+                double angle;
+                if (!object_ref(object) || !number(angle)) return false;
+                out = make_shared<rotate_y>(object, angle);
+            } else if (type == "flip_face") {
+                shared_ptr<hittable> object;
+                if (!object_ref(object)) return false;
+                out = make_shared<flip_face>(object);
+            } else if (type == "instance") {
+                shared_ptr<hittable> object;
+                if (!object_ref(object)) return false;
+
+                auto to_world = affine_transform::identity();
+                while (!at_end()) {
+                    std::string_view key;
+                    word(key);
+                    vec3 v;
+                    double x;
+                    if (key == "translate") {
+                        if (!vector(v)) return false;
+                        to_world = affine_transform::translation(v) * to_world;
+                    } else if (key == "rotate") {
+                        if (!vector(v) || !number(x)) return false;
+                        if (v.near_zero()) return fail("rotation about a zero axis");
+                        to_world = affine_transform::rotation(v, x) * to_world;
+                    } else if (key == "scale") {
+                        if (!number(x)) return false;
+                        double y = x, z = x;
+                        if (peek_number() && (!number(y) || !number(z))) return false;
+                        v = vec3(x, y, z);
+                        to_world = affine_transform::scaling(v) * to_world;
+                    } else {
+                        return fail("unknown instance step '" + std::string(key) + "'");
+                    }
+                }
+
+                affine_transform to_object;
+                if (!to_world.inverse(to_object))
+                    return fail("instance transform is not invertible");
+                out = make_shared<instance>(object, to_world);
+            } else if (type == "constant_medium") {
+                shared_ptr<hittable> object;
+                shared_ptr<texture> tex;
+                double density;
+                if (!object_ref(object) || !number(density) || !texture_ref(tex)) return false;
+                out = make_shared<constant_medium>(object, density, result->materials.add<isotropic>(tex),
+                                                   result->next_medium_stream());
+            } else if (type == "bvh") {
+                std::string_view name;
+                if (!word(name)) return false;
+                auto found = group_lists.find(std::string(name));
+                if (found == group_lists.end())
+                    return fail("unknown group '" + std::string(name) + "'");
+                if (found->second->objects.empty())
+                    return fail("bvh over empty group '" + std::string(name) + "'");
+
+                bvh_build_settings settings = default_bvh_settings();
+                while (!at_end()) {
+                    std::string_view key;
+                    word(key);
+                    bool ok;
+                    if      (key == "leaf")         ok = integer(settings.max_leaf_size);
+                    else if (key == "bins")         ok = integer(settings.bins);
+                    else if (key == "traversal")    ok = number(settings.traversal_cost);
+                    else if (key == "intersection") ok = number(settings.intersection_cost);
+                    else if (key == "threads")      ok = integer(settings.num_threads);
+                    else if (key == "width")        ok = integer(settings.width);
+                    else return fail("unknown bvh setting '" + std::string(key) + "'");
+                    if (!ok) return false;
+                }
+                out = make_shared<bvh_node>(*found->second, result->time0, result->time1, settings);
+            } else if (type == "sphere_set") {
+                std::string_view name;
+                if (!word(name)) return false;
+                auto found = group_lists.find(std::string(name));
+                if (found == group_lists.end())
+                    return fail("unknown group '" + std::string(name) + "'");
+                if (found->second->objects.empty())
+                    return fail("sphere_set over empty group '" + std::string(name) + "'");
+
+                std::vector<point3> centers;
+                std::vector<double> radii;
+                std::vector<const material*> sphere_materials;
+                for (auto& object : found->second->objects) {
+                    auto s = dynamic_cast<const sphere*>(object.get());
+                    if (!s)
+                        return fail("group '" + std::string(name) + "' holds objects other than spheres");
+                    centers.push_back(s->center);
+                    radii.push_back(s->radius);
+                    sphere_materials.push_back(s->mat_ptr);
+                }
+                out = make_shared<sphere_set>(centers, radii, sphere_materials);
+            } else {
+                return fail("unknown statement '" + std::string(type) + "'");
+            }
+            return true;
+        }
+};
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cstdint>
+
+// Thin wrapper over the widest double-precision SIMD registers the build targets: AVX
+// (4 lanes), SSE2 (2 lanes), or plain scalars. Code written against vdouble processes
+// vdouble::width consecutive array elements per step and builds with any of the three.
+// Loading from a float array widens each element to double, which is exact.
+//
+// min() and max() follow the x86 convention of returning the second operand when either
+// is NaN, which is what the scalar slab test's "t0 > t_min ? t0 : t_min" does as well.
+
+#if defined(__AVX__)
+#include <immintrin.h>
+
+struct vmask {
+    __m256d m;
+    int bits() const { return _mm256_movemask_pd(m); }
+};
+
+struct vdouble {
+    static constexpr int width = 4;
+    __m256d v;
+
+    vdouble() {}
+    vdouble(__m256d x) : v(x) {}
+    vdouble(double x) : v(_mm256_set1_pd(x)) {}
+
+    static vdouble load(const double* p) { return _mm256_loadu_pd(p); }
+    static vdouble load(const float* p) { return _mm256_cvtps_pd(_mm_loadu_ps(p)); }
+    void store(double* p) const { _mm256_storeu_pd(p, v); }
+};
+
+inline vdouble operator+(vdouble a, vdouble b) { return _mm256_add_pd(a.v, b.v); }
+inline vdouble operator-(vdouble a, vdouble b) { return _mm256_sub_pd(a.v, b.v); }
+inline vdouble operator*(vdouble a, vdouble b) { return _mm256_mul_pd(a.v, b.v); }
+inline vdouble operator/(vdouble a, vdouble b) { return _mm256_div_pd(a.v, b.v); }
+inline vdouble min(vdouble a, vdouble b) { return _mm256_min_pd(a.v, b.v); }
+inline vdouble max(vdouble a, vdouble b) { return _mm256_max_pd(a.v, b.v); }
+inline vdouble sqrt(vdouble a) { return _mm256_sqrt_pd(a.v); }
+
+inline vmask operator<(vdouble a, vdouble b)  { return {_mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ)}; }
+inline vmask operator<=(vdouble a, vdouble b) { return {_mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ)}; }
+inline vmask operator>=(vdouble a, vdouble b) { return {_mm256_cmp_pd(a.v, b.v, _CMP_GE_OQ)}; }
+inline vmask operator&(vmask a, vmask b) { return {_mm256_and_pd(a.m, b.m)}; }
+inline vmask operator|(vmask a, vmask b) { return {_mm256_or_pd(a.m, b.m)}; }
+
+// Lanes of a where m is set, lanes of b elsewhere.
+inline vdouble select(vmask m, vdouble a, vdouble b) { return _mm256_blendv_pd(b.v, a.v, m.m); }
+
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+
+struct vmask {
+    __m128d m;
+    int bits() const { return _mm_movemask_pd(m); }
+};
+
+struct vdouble {
+    static constexpr int width = 2;
+    __m128d v;
+
+    vdouble() {}
+    vdouble(__m128d x) : v(x) {}
+    vdouble(double x) : v(_mm_set1_pd(x)) {}
+
+    static vdouble load(const double* p) { return _mm_loadu_pd(p); }
+    static vdouble load(const float* p) {
+        return _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+    }
+    void store(double* p) const { _mm_storeu_pd(p, v); }
+};
+
+inline vdouble operator+(vdouble a, vdouble b) { return _mm_add_pd(a.v, b.v); }
+inline vdouble operator-(vdouble a, vdouble b) { return _mm_sub_pd(a.v, b.v); }
+inline vdouble operator*(vdouble a, vdouble b) { return _mm_mul_pd(a.v, b.v); }
+inline vdouble operator/(vdouble a, vdouble b) { return _mm_div_pd(a.v, b.v); }
+inline vdouble min(vdouble a, vdouble b) { return _mm_min_pd(a.v, b.v); }
+inline vdouble max(vdouble a, vdouble b) { return _mm_max_pd(a.v, b.v); }
+inline vdouble sqrt(vdouble a) { return _mm_sqrt_pd(a.v); }
+
+inline vmask operator<(vdouble a, vdouble b)  { return {_mm_cmplt_pd(a.v, b.v)}; }
+inline vmask operator<=(vdouble a, vdouble b) { return {_mm_cmple_pd(a.v, b.v)}; }
+inline vmask operator>=(vdouble a, vdouble b) { return {_mm_cmpge_pd(a.v, b.v)}; }
+inline vmask operator&(vmask a, vmask b) { return {_mm_and_pd(a.m, b.m)}; }
+inline vmask operator|(vmask a, vmask b) { return {_mm_or_pd(a.m, b.m)}; }
+
+inline vdouble select(vmask m, vdouble a, vdouble b) {
+    return _mm_or_pd(_mm_and_pd(m.m, a.v), _mm_andnot_pd(m.m, b.v));
+}
+
+#else
+#include <cmath>
+
+struct vmask {
+    bool m;
+    int bits() const { return m ? 1 : 0; }
+};
+
+struct vdouble {
+    static constexpr int width = 1;
+    double v;
+
+    vdouble() {}
+    vdouble(double x) : v(x) {}
+
+    static vdouble load(const double* p) { return *p; }
+    static vdouble load(const float* p) { return *p; }
+    void store(double* p) const { *p = v; }
+};
+
+inline vdouble operator+(vdouble a, vdouble b) { return a.v + b.v; }
+inline vdouble operator-(vdouble a, vdouble b) { return a.v - b.v; }
+inline vdouble operator*(vdouble a, vdouble b) { return a.v * b.v; }
+inline vdouble operator/(vdouble a, vdouble b) { return a.v / b.v; }
+inline vdouble min(vdouble a, vdouble b) { return a.v < b.v ? a.v : b.v; }
+inline vdouble max(vdouble a, vdouble b) { return a.v > b.v ? a.v : b.v; }
+inline vdouble sqrt(vdouble a) { return std::sqrt(a.v); }
+
+inline vmask operator<(vdouble a, vdouble b)  { return {a.v < b.v}; }
+inline vmask operator<=(vdouble a, vdouble b) { return {a.v <= b.v}; }
+inline vmask operator>=(vdouble a, vdouble b) { return {a.v >= b.v}; }
+inline vmask operator&(vmask a, vmask b) { return {a.m && b.m}; }
+inline vmask operator|(vmask a, vmask b) { return {a.m || b.m}; }
+
+inline vdouble select(vmask m, vdouble a, vdouble b) { return m.m ? a : b; }
+
+#endif
+
+// vdouble::width 3D vectors stored structure-of-arrays, one component per register, for
+// kernels that run the same vector math on many rays or primitives at once: a triangle
+// batch, a ray packet's lanes. Lane i of x, y and z is the i-th vector.
+struct vvec3 {
+    vdouble x, y, z;
+
+    vvec3() {}
+    vvec3(vdouble x, vdouble y, vdouble z) : x(x), y(y), z(z) {}
+
+    // The same vector in every lane.
+    template <typename Vec3>
+    static vvec3 broadcast(const Vec3& v) { return {vdouble(v.x()), vdouble(v.y()), vdouble(v.z())}; }
+
+    // Lanes from vdouble::width consecutive elements of three component arrays.
+    template <typename T>
+    static vvec3 load(const T* x, const T* y, const T* z) {
+        return {vdouble::load(x), vdouble::load(y), vdouble::load(z)};
+    }
+
+    void store(double* px, double* py, double* pz) const { x.store(px); y.store(py); z.store(pz); }
+};
+
+inline vvec3 operator+(const vvec3& a, const vvec3& b) { return {a.x + b.x, a.y + b.y, a.z + b.z}; }
+inline vvec3 operator-(const vvec3& a, const vvec3& b) { return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+inline vvec3 operator*(const vvec3& a, const vvec3& b) { return {a.x * b.x, a.y * b.y, a.z * b.z}; }
+inline vvec3 operator*(vdouble t, const vvec3& a) { return {t * a.x, t * a.y, t * a.z}; }
+inline vvec3 operator*(const vvec3& a, vdouble t) { return t * a; }
+
+inline vdouble dot(const vvec3& a, const vvec3& b) { return a.x*b.x + a.y*b.y + a.z*b.z; }
+
+inline vvec3 cross(const vvec3& a, const vvec3& b) {
+    return {a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x};
+}
+
+inline vvec3 select(vmask m, const vvec3& a, const vvec3& b) {
+    return {select(m, a.x, b.x), select(m, a.y, b.y), select(m, a.z, b.z)};
+}
+
+// Index of the lowest set bit of a non-zero lane mask.
+inline int lowest_lane(uint32_t mask) {
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int lane = 0;
+    while (!(mask & 1)) { mask >>= 1; lane++; }
+    return lane;
+#endif
+}
+
+#endif
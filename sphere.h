@@ -1,24 +1,30 @@
+#ifndef SPHERE_H
+#define SPHERE_H
+
 #include "rtweekend.h"
 
 #include "hittable.h"
+#include "ONB.h"
 
 
 class sphere : public hittable {
     public:
         sphere() {}
 
-        sphere(point3 cen, double r, shared_ptr<material> m)
+        sphere(point3 cen, double r, const material* m)
             : center(cen), radius(r), mat_ptr(m) {};
 
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
+        virtual double pdf_value(const point3& o, const vec3& v) const override;
+        virtual vec3 random(const point3& o, sampler& rng) const override;
+        virtual uint32_t hit_packet(const ray_packet& rays, uint32_t active, double t_min,
+                                    double* t_max, hit_record* const* rec) const override;
+        virtual uint32_t occluded_packet(const ray_packet& rays, uint32_t active, double t_min,
+                                         const double* t_max) const override;
 
-    public:
-        point3 center;
-        double radius;
-        shared_ptr<material> mat_ptr;
-
-    private:
+        // u and v of a point p on the unit sphere, as hit() reports them.
         static void get_sphere_uv(const point3& p, double& u, double& v) {
             auto theta = acos(-p.y());
             auto phi = atan2(-p.z(), p.x()) + pi;
@@ -26,6 +32,19 @@ class sphere : public hittable {
             u = phi / (2*pi);
             v = theta / pi;
         }
+
+    public:
+        point3 center;
+        double radius;
+        const material* mat_ptr;
+
+    private:
+        // The root of r's quadratic hit() and occluded() accept: the nearest one between
+        // t_min and t_max, if either is.
+        bool nearest_root(const ray& r, double t_min, double t_max, double& root) const;
+
+        // The active lanes of a packet that might hit the sphere at all.
+        uint32_t packet_candidates(const ray_packet& rays, uint32_t active) const;
 };
 
 bool sphere::bounding_box(double time0, double time1, aabb& output_box) const {
@@ -35,10 +54,13 @@ bool sphere::bounding_box(double time0, double time1, aabb& output_box) const {
     return true;
 }
 
-bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    vec3 oc = r.origin() - center;
-    auto a = r.direction().length_squared();
-    auto half_b = dot(oc, r.direction());
+bool sphere::nearest_root(const ray& r, double t_min, double t_max, double& root) const {
+    // Always in double: on a sphere as big as a ground plane |oc|^2 and radius^2 cancel
+    // almost completely, which leaves nothing of a float's precision.
+    dvec3 oc = dvec3(r.origin()) - dvec3(center);
+    dvec3 direction(r.direction());
+    auto a = direction.length_squared();
+    auto half_b = dot(oc, direction);
     auto c = oc.length_squared() - radius*radius;
 
     auto discriminant = half_b*half_b - a*c;
@@ -46,12 +68,24 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
     auto sqrtd = sqrt(discriminant);
 
     // Find the nearest root that lies in the acceptable range.
-    auto root = (-half_b - sqrtd) / a;
+    root = (-half_b - sqrtd) / a;
     if (root < t_min || t_max < root) {
         root = (-half_b + sqrtd) / a;
         if (root < t_min || t_max < root)
             return false;
     }
+    return true;
+}
+
+bool sphere::occluded(const ray& r, double t_min, double t_max) const {
+    double root;
+    return nearest_root(r, t_min, t_max, root);
+}
+
+bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    double root;
+    if (!nearest_root(r, t_min, t_max, root))
+        return false;
 
     rec.t = root;
     rec.p = r.at(rec.t);
@@ -61,4 +95,85 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
     rec.mat_ptr = mat_ptr;
 
     return true;
-}
\ No newline at end of file
+}
+
+uint32_t sphere::packet_candidates(const ray_packet& rays, uint32_t active) const {
+    // Rejects vdouble::width lanes at a time on the sign of hit()'s discriminant. The few
+    // lanes that survive run the scalar test, so a packet finds exactly the hits single
+    // rays would. The slack keeps grazing rays that rounding could put on either side.
+    const auto cv = vvec3::broadcast(center);
+    const vdouble rr(radius*radius), slack(-1e-9);
+
+    uint32_t candidates = 0;
+    for (int c = 0; c < rays.size; c += vdouble::width) {
+        if (((active >> c) & ((1u << vdouble::width) - 1)) == 0)
+            continue;
+
+        auto oc = rays.origins(c) - cv;
+        auto d = rays.directions(c);
+
+        auto a = dot(d, d);
+        auto half_b = dot(oc, d);
+        auto oc2 = dot(oc, oc);
+        auto b2 = half_b*half_b;
+        auto discriminant = b2 - a*(oc2 - rr);
+        candidates |= static_cast<uint32_t>((discriminant >= slack * (b2 + a*(oc2 + rr))).bits()) << c;
+    }
+    return candidates & active;
+}
+
+uint32_t sphere::hit_packet(
+    const ray_packet& rays, uint32_t active, double t_min, double* t_max, hit_record* const* rec
+) const {
+    uint32_t hits = 0;
+    for (auto lanes = packet_candidates(rays, active); lanes; lanes &= lanes - 1) {
+        int l = lowest_lane(lanes);
+        if (hit(rays.get(l), t_min, t_max[l], *rec[l])) {
+            t_max[l] = rec[l]->t;
+            hits |= 1u << l;
+        }
+    }
+    return hits;
+}
+
+uint32_t sphere::occluded_packet(
+    const ray_packet& rays, uint32_t active, double t_min, const double* t_max
+) const {
+    uint32_t blocked = 0;
+    for (auto lanes = packet_candidates(rays, active); lanes; lanes &= lanes - 1) {
+        int l = lowest_lane(lanes);
+        if (occluded(rays.get(l), t_min, t_max[l]))
+            blocked |= 1u << l;
+    }
+    return blocked;
+}
+
+double sphere::pdf_value(const point3& o, const vec3& v) const {
+    // Sampling the cone of directions the sphere subtends from o.
+    if (!occluded(ray(o, v), 0.001, infinity))
+        return 0;
+
+    auto cos_theta_max = sqrt(1 - radius*radius/(center-o).length_squared());
+    auto solid_angle = 2*pi*(1-cos_theta_max);
+
+    return  1 / solid_angle;
+}
+
+vec3 sphere::random(const point3& o, sampler& rng) const {
+    vec3 direction = center - o;
+    auto distance_squared = direction.length_squared();
+    onb uvw;
+    uvw.build_from_w(direction);
+
+    auto r1 = rng.random_double();
+    auto r2 = rng.random_double();
+    auto z = 1 + r2*(sqrt(1-radius*radius/distance_squared) - 1);
+
+    auto phi = 2*pi*r1;
+    auto x = cos(phi)*sqrt(1-z*z);
+    auto y = sin(phi)*sqrt(1-z*z);
+
+    return uvw.local(x, y, z);
+}
+
+#endif
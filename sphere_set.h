@@ -0,0 +1,175 @@
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "simd.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Many static spheres as one hittable with its own BVH, for particle clouds and the like:
+// no shared_ptr, vtable call or hit_record copy per sphere, and 36 bytes of storage per
+// sphere plus its share of the tree. Centers, radii and material indices are stored
+// structure-of-arrays in BVH leaf order, so a leaf is a run of consecutive entries and is
+// tested vdouble::width spheres at a time straight from the arrays. Materials are kept once
+// in a palette that the indices point into.
+//
+// The test is sphere::hit()'s quadratic in double precision, so a sphere in a set is hit
+// where the same sphere on its own would be, and is shaded the same way.
+class sphere_set : public hittable {
+    public:
+        // One material per sphere; centers, radii and materials must be the same length.
+        sphere_set(const std::vector<point3>& centers, const std::vector<double>& radii,
+                   const std::vector<const material*>& sphere_materials,
+                   const bvh_build_settings& settings = default_settings());
+
+        // default_bvh_settings() with leaves big enough to fill SIMD batches, and with a
+        // sphere counted as a fraction of a batch when the builder weighs leaves.
+        static bvh_build_settings default_settings() {
+            auto settings = default_bvh_settings();
+            settings.max_leaf_size = std::max(settings.max_leaf_size, 2 * vdouble::width);
+            settings.intersection_cost /= vdouble::width;
+            return settings;
+        }
+
+        virtual bool hit(
+            const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+
+        virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
+            output_box = tree.box;
+            return sphere_count() > 0;
+        }
+
+        uint32_t sphere_count() const { return spheres; }
+
+    public:
+        // In leaf order, each padded with vdouble::width - 1 copies of the last sphere so a
+        // batch can always load a full register.
+        std::vector<double> center_x, center_y, center_z, radius;
+        std::vector<uint32_t> material_index;
+        std::vector<const material*> materials;
+        uint32_t spheres;       // not counting the padding
+        bvh_tree tree;
+
+    private:
+        // Tests spheres [first, first + n), n <= vdouble::width, in one batch. Returns a bit
+        // per sphere hit between t_min and t_max and stores each lane's nearest such root in t.
+        uint32_t intersect(const ray& r, uint32_t first, uint32_t n, double t_min, double t_max,
+                           double* t) const;
+};
+
+
+sphere_set::sphere_set(const std::vector<point3>& centers, const std::vector<double>& radii,
+                       const std::vector<const material*>& sphere_materials,
+                       const bvh_build_settings& settings)
+    : spheres(static_cast<uint32_t>(centers.size())) {
+    std::vector<uint32_t> order;
+    tree.build(spheres, settings, [&](uint32_t i, aabb& box) {
+        vec3 extent(radii[i], radii[i], radii[i]);
+        box = aabb(centers[i] - extent, centers[i] + extent);
+        return true;
+    }, order);
+
+    std::unordered_map<const material*, uint32_t> palette;
+    size_t padded = spheres == 0 ? 0 : spheres + vdouble::width - 1;
+    for (auto array : { &center_x, &center_y, &center_z, &radius })
+        array->reserve(padded);
+    material_index.reserve(padded);
+
+    for (size_t i = 0; i < padded; i++) {
+        auto s = order[std::min<size_t>(i, spheres - 1)];
+        center_x.push_back(centers[s].x());
+        center_y.push_back(centers[s].y());
+        center_z.push_back(centers[s].z());
+        radius.push_back(radii[s]);
+
+        auto found = palette.emplace(sphere_materials[s], static_cast<uint32_t>(materials.size()));
+        if (found.second)
+            materials.push_back(sphere_materials[s]);
+        material_index.push_back(found.first->second);
+    }
+}
+
+
+uint32_t sphere_set::intersect(const ray& r, uint32_t first, uint32_t n, double t_min,
+                               double t_max, double* t) const {
+    auto center = vvec3::load(&center_x[first], &center_y[first], &center_z[first]);
+    auto rad = vdouble::load(&radius[first]);
+
+    auto oc = vvec3::broadcast(dvec3(r.origin())) - center;
+    auto direction = vvec3::broadcast(dvec3(r.direction()));
+    auto a = dot(direction, direction);
+    auto half_b = dot(oc, direction);
+    auto c = dot(oc, oc) - rad*rad;
+
+    // A negative discriminant gives a NaN square root, and NaN roots fail every comparison.
+    auto sqrtd = sqrt(half_b*half_b - a*c);
+    const vdouble zero(0.0), lo(t_min), hi(t_max);
+    auto near_root = (zero - half_b - sqrtd) / a;
+    auto far_root = (zero - half_b + sqrtd) / a;
+    auto near_ok = (lo <= near_root) & (near_root <= hi);
+    auto far_ok = (lo <= far_root) & (far_root <= hi);
+
+    select(near_ok, near_root, far_root).store(t);
+    return static_cast<uint32_t>((near_ok | far_ok).bits()) & ((1u << n) - 1);
+}
+
+
+bool sphere_set::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    constexpr int W = vdouble::width;
+    uint32_t closest = 0;
+
+    bool hit_anything = tree.closest_hit(r, t_min, t_max,
+        [&](uint32_t first, uint32_t count, double& t_max) {
+            alignas(32) double t[W];
+            bool hit_leaf = false;
+            for (uint32_t batch = first; batch < first + count; batch += W) {
+                auto hits = intersect(r, batch, std::min<uint32_t>(W, first + count - batch),
+                                      t_min, t_max, t);
+                for (; hits != 0; hits &= hits - 1) {
+                    int i = lowest_lane(hits);
+                    if (t[i] < t_max) {
+                        t_max = t[i];
+                        closest = batch + i;
+                        hit_leaf = true;
+                    }
+                }
+            }
+            if (hit_leaf)
+                rec.t = t_max;
+            return hit_leaf;
+        });
+
+    if (!hit_anything)
+        return false;
+
+    point3 center(center_x[closest], center_y[closest], center_z[closest]);
+    rec.p = r.at(rec.t);
+    vec3 outward_normal = (rec.p - center) / radius[closest];
+    rec.set_face_normal(r, outward_normal);
+    sphere::get_sphere_uv(outward_normal, rec.u, rec.v);
+    rec.mat_ptr = materials[material_index[closest]];
+    return true;
+}
+
+
+bool sphere_set::occluded(const ray& r, double t_min, double t_max) const {
+    constexpr int W = vdouble::width;
+    return tree.any_hit(r, t_min, t_max, [&](uint32_t first, uint32_t count) {
+        alignas(32) double t[W];
+        for (uint32_t batch = first; batch < first + count; batch += W)
+            if (intersect(r, batch, std::min<uint32_t>(W, first + count - batch), t_min, t_max, t))
+                return true;
+        return false;
+    });
+}
+
+#endif
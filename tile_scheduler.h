@@ -0,0 +1,118 @@
+#ifndef TILE_SCHEDULER_H
+#define TILE_SCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A rectangular block of pixels, [x0,x1) x [y0,y1), with y counted upward from the bottom
+// scanline the same way the camera's v coordinate is.
+struct tile {
+    int x0, y0;
+    int x1, y1;
+};
+
+// Splits the image into tiles and renders them on a pool of worker threads. Each worker
+// owns a deque of tiles: it pops work from the back of its own deque and, once that runs
+// dry, steals from the front of the other workers' deques. Tiles are dealt out in
+// contiguous runs so neighbouring tiles (and their cache footprint) stay on one thread
+// until stealing kicks in.
+class tile_scheduler {
+    public:
+        tile_scheduler(int image_width, int image_height, int tile_size, int num_threads)
+            : tile_scheduler(tile{0, 0, image_width, image_height}, tile_size, num_threads)
+        {}
+
+        // Covers only the given region of the image, e.g. one job of a distributed render.
+        tile_scheduler(const tile& region, int tile_size, int num_threads, bool progress = true)
+            : queues(std::max(num_threads, 1)), show_progress(progress)
+        {
+            std::vector<tile> tiles;
+            for (int y1 = region.y1; y1 > region.y0; y1 -= tile_size)
+                for (int x0 = region.x0; x0 < region.x1; x0 += tile_size)
+                    tiles.push_back({x0, std::max(y1 - tile_size, region.y0), std::min(x0 + tile_size, region.x1), y1});
+
+            total_tiles = static_cast<int>(tiles.size());
+            auto per_queue = (tiles.size() + queues.size() - 1) / queues.size();
+            for (size_t t = 0; t < tiles.size(); t++)
+                queues[t / per_queue].tiles.push_back(tiles[t]);
+        }
+
+        int num_threads() const { return static_cast<int>(queues.size()); }
+
+        // Runs render_tile over every tile and blocks until all of them are done. The
+        // callback is invoked concurrently from several threads and must only write
+        // pixels belonging to the tile it was handed. Its second argument is the calling
+        // worker's index in [0, num_threads()), for keeping per-thread scratch state.
+        void run(const std::function<void(const tile&, int)>& render_tile) {
+            tiles_done = 0;
+            report_progress();
+
+            std::vector<std::thread> workers;
+            for (int id = 1; id < num_threads(); id++)
+                workers.emplace_back(&tile_scheduler::worker_loop, this, id, std::cref(render_tile));
+
+            worker_loop(0, render_tile);
+
+            for (auto& w : workers)
+                w.join();
+        }
+
+    private:
+        struct work_queue {
+            std::mutex lock;
+            std::deque<tile> tiles;
+        };
+
+        std::vector<work_queue> queues;
+        std::atomic<int> tiles_done{0};
+        std::mutex progress_lock;
+        int total_tiles;
+        bool show_progress;
+
+        bool pop_local(int id, tile& t) {
+            auto& q = queues[id];
+            std::lock_guard<std::mutex> guard(q.lock);
+            if (q.tiles.empty()) return false;
+            t = q.tiles.back();
+            q.tiles.pop_back();
+            return true;
+        }
+
+        bool steal(int thief, tile& t) {
+            for (int k = 1; k < num_threads(); k++) {
+                auto& q = queues[(thief + k) % num_threads()];
+                std::lock_guard<std::mutex> guard(q.lock);
+                if (q.tiles.empty()) continue;
+                t = q.tiles.front();
+                q.tiles.pop_front();
+                return true;
+            }
+            return false;
+        }
+
+        void worker_loop(int id, const std::function<void(const tile&, int)>& render_tile) {
+            tile t;
+            while (pop_local(id, t) || steal(id, t)) {
+                render_tile(t, id);
+                tiles_done++;
+                report_progress();
+            }
+        }
+
+        void report_progress() {
+            // An empty image has nothing to report, and its percentage would be 0/0.
+            if (!show_progress || total_tiles == 0) return;
+            std::lock_guard<std::mutex> guard(progress_lock);
+            int remaining = total_tiles - tiles_done;
+            int percent_left = static_cast<int>(100*((float)remaining/(float)total_tiles));
+            std::cerr << "\rTiles Remaining: " << remaining << " | " << percent_left << "\% left" << " | " << std::flush;
+        }
+};
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "rtweekend.h"
+
+#include "vec3.h"
+
+#include <cmath>
+
+// An affine transform, stored as the top three rows of a 4x4 matrix: the linear part in
+// columns 0-2 and the translation in column 3. Products apply right to left, so
+// translation(t) * rotation(axis, angle) rotates first and then moves.
+struct affine_transform {
+    double m[3][4];
+
+    static affine_transform identity() {
+        return scaling(vec3(1, 1, 1));
+    }
+
+    static affine_transform translation(const vec3& offset) {
+        auto t = identity();
+        for (int i = 0; i < 3; i++)
+            t.m[i][3] = offset[i];
+        return t;
+    }
+
+    static affine_transform scaling(const vec3& factors) {
+        affine_transform t{};
+        for (int i = 0; i < 3; i++)
+            t.m[i][i] = factors[i];
+        return t;
+    }
+
+    // Right-handed rotation about axis, which need not be unit length.
+    static affine_transform rotation(const vec3& axis, double degrees) {
+        auto a = unit_vector(axis);
+        auto radians = degrees_to_radians(degrees);
+        auto c = cos(radians), s = sin(radians), k = 1 - c;
+
+        affine_transform t{};
+        t.m[0][0] = c + a.x()*a.x()*k;
+        t.m[0][1] = a.x()*a.y()*k - a.z()*s;
+        t.m[0][2] = a.x()*a.z()*k + a.y()*s;
+        t.m[1][0] = a.y()*a.x()*k + a.z()*s;
+        t.m[1][1] = c + a.y()*a.y()*k;
+        t.m[1][2] = a.y()*a.z()*k - a.x()*s;
+        t.m[2][0] = a.z()*a.x()*k - a.y()*s;
+        t.m[2][1] = a.z()*a.y()*k + a.x()*s;
+        t.m[2][2] = c + a.z()*a.z()*k;
+        return t;
+    }
+
+    point3 point(const point3& p) const {
+        return vector(p) + vec3(m[0][3], m[1][3], m[2][3]);
+    }
+
+    vec3 vector(const vec3& v) const {
+        return vec3(m[0][0]*v.x() + m[0][1]*v.y() + m[0][2]*v.z(),
+                    m[1][0]*v.x() + m[1][1]*v.y() + m[1][2]*v.z(),
+                    m[2][0]*v.x() + m[2][1]*v.y() + m[2][2]*v.z());
+    }
+
+    // v times the transpose of the linear part. On the inverse transform this is how
+    // normals cross over, since they have to stay perpendicular to transformed surfaces.
+    vec3 transposed_vector(const vec3& v) const {
+        return vec3(m[0][0]*v.x() + m[1][0]*v.y() + m[2][0]*v.z(),
+                    m[0][1]*v.x() + m[1][1]*v.y() + m[2][1]*v.z(),
+                    m[0][2]*v.x() + m[1][2]*v.y() + m[2][2]*v.z());
+    }
+
+    double determinant() const {
+        return m[0][0] * (m[1][1]*m[2][2] - m[1][2]*m[2][1])
+             - m[0][1] * (m[1][0]*m[2][2] - m[1][2]*m[2][0])
+             + m[0][2] * (m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+    }
+
+    // Stores the inverse transform in out. Returns false, leaving out alone, when the
+    // linear part is singular.
+    bool inverse(affine_transform& out) const {
+        auto det = determinant();
+        if (det == 0 || !std::isfinite(det))
+            return false;
+
+        affine_transform inv;
+        auto inv_det = 1 / det;
+        inv.m[0][0] = (m[1][1]*m[2][2] - m[1][2]*m[2][1]) * inv_det;
+        inv.m[0][1] = (m[0][2]*m[2][1] - m[0][1]*m[2][2]) * inv_det;
+        inv.m[0][2] = (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * inv_det;
+        inv.m[1][0] = (m[1][2]*m[2][0] - m[1][0]*m[2][2]) * inv_det;
+        inv.m[1][1] = (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * inv_det;
+        inv.m[1][2] = (m[0][2]*m[1][0] - m[0][0]*m[1][2]) * inv_det;
+        inv.m[2][0] = (m[1][0]*m[2][1] - m[1][1]*m[2][0]) * inv_det;
+        inv.m[2][1] = (m[0][1]*m[2][0] - m[0][0]*m[2][1]) * inv_det;
+        inv.m[2][2] = (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * inv_det;
+
+        auto offset = inv.vector(vec3(m[0][3], m[1][3], m[2][3]));
+        for (int i = 0; i < 3; i++)
+            inv.m[i][3] = -offset[i];
+
+        out = inv;
+        return true;
+    }
+};
+
+inline affine_transform operator*(const affine_transform& a, const affine_transform& b) {
+    affine_transform t;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            t.m[i][j] = a.m[i][0]*b.m[0][j] + a.m[i][1]*b.m[1][j] + a.m[i][2]*b.m[2][j];
+            if (j == 3)
+                t.m[i][j] += a.m[i][3];
+        }
+    }
+    return t;
+}
+
+#endif
@@ -0,0 +1,190 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// An indexed triangle mesh: one hittable with its own BVH over every triangle, so a model
+// with millions of triangles costs one object in the scene instead of a shared_ptr and a
+// vtable call per triangle. Vertex positions are single precision, like BVH bounds, and
+// triangles are three indices into them, so a vertex shared by six triangles is stored once
+// and a triangle costs 12 bytes plus its share of the vertices and the tree.
+//
+// The index buffer is kept in BVH leaf order, so a leaf is a run of consecutive triangles.
+// Leaves are tested vdouble::width triangles at a time with the Möller–Trumbore test: their
+// vertices are gathered from the shared buffers into lanes rather than stored a second
+// time per leaf, which keeps memory at the size of the model. The test has no epsilon and
+// culls no faces; rays parallel to a triangle come out as NaN or infinite barycentrics,
+// which fail the comparisons.
+class triangle_mesh : public hittable {
+    public:
+        // positions holds x, y, z per vertex and indices three vertex indices per triangle,
+        // all of which must be in range (mesh_loader checks this).
+        triangle_mesh(std::vector<float> positions, std::vector<uint32_t> indices,
+                      const material* mat, const bvh_build_settings& settings = default_settings());
+
+        // default_bvh_settings() with leaves big enough to fill SIMD batches, and with a
+        // triangle counted as a fraction of a batch when the builder weighs leaves.
+        static bvh_build_settings default_settings() {
+            auto settings = default_bvh_settings();
+            settings.max_leaf_size = std::max(settings.max_leaf_size, 2 * vdouble::width);
+            settings.intersection_cost /= vdouble::width;
+            return settings;
+        }
+
+        virtual bool hit(
+            const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+
+        virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
+            output_box = tree.box;
+            return triangle_count() > 0;
+        }
+
+        uint32_t triangle_count() const { return static_cast<uint32_t>(indices.size() / 3); }
+
+    public:
+        std::vector<float> positions;
+        std::vector<uint32_t> indices;      // in leaf order
+        const material* mp;
+        bvh_tree tree;
+
+    private:
+        point3 vertex(uint32_t index) const {
+            const float* p = &positions[3 * size_t(index)];
+            return point3(p[0], p[1], p[2]);
+        }
+
+        // Tests triangles [first, first + n), n <= vdouble::width, in one batch. Returns a
+        // bit per triangle hit between t_min and t_max and stores each lane's distance and
+        // barycentrics in t, u and v.
+        uint32_t intersect(const ray& r, uint32_t first, uint32_t n, double t_min, double t_max,
+                           double* t, double* u, double* v) const;
+};
+
+
+triangle_mesh::triangle_mesh(std::vector<float> vertex_positions, std::vector<uint32_t> triangle_indices,
+                             const material* mat, const bvh_build_settings& settings)
+    : positions(std::move(vertex_positions)), indices(std::move(triangle_indices)), mp(mat) {
+    std::vector<uint32_t> order;
+    tree.build(triangle_count(), settings, [this](uint32_t i, aabb& box) {
+        auto a = vertex(indices[3*i]), b = vertex(indices[3*i+1]), c = vertex(indices[3*i+2]);
+        box = aabb(point3(fmin(a.x(), fmin(b.x(), c.x())), fmin(a.y(), fmin(b.y(), c.y())),
+                          fmin(a.z(), fmin(b.z(), c.z()))),
+                   point3(fmax(a.x(), fmax(b.x(), c.x())), fmax(a.y(), fmax(b.y(), c.y())),
+                          fmax(a.z(), fmax(b.z(), c.z()))));
+        return true;
+    }, order);
+
+    std::vector<uint32_t> sorted(indices.size());
+    for (size_t i = 0; i < order.size(); i++)
+        std::copy_n(&indices[3 * size_t(order[i])], 3, &sorted[3 * i]);
+    indices.swap(sorted);
+}
+
+
+uint32_t triangle_mesh::intersect(const ray& r, uint32_t first, uint32_t n, double t_min,
+                                  double t_max, double* t, double* u, double* v) const {
+    constexpr int W = vdouble::width;
+
+    // Corner c of lane i's triangle goes to lanes[3*c + axis][i]. Lanes past n repeat the
+    // last triangle and are masked off below.
+    alignas(32) double lanes[9][W];
+    for (int i = 0; i < W; i++) {
+        const uint32_t* triangle = &indices[3 * size_t(first + std::min<uint32_t>(i, n - 1))];
+        for (int c = 0; c < 3; c++) {
+            const float* p = &positions[3 * size_t(triangle[c])];
+            for (int a = 0; a < 3; a++)
+                lanes[3*c + a][i] = p[a];
+        }
+    }
+
+    auto o = vvec3::broadcast(r.origin()), d = vvec3::broadcast(r.direction());
+    auto p0 = vvec3::load(lanes[0], lanes[1], lanes[2]);
+    auto e1 = vvec3::load(lanes[3], lanes[4], lanes[5]) - p0;
+    auto e2 = vvec3::load(lanes[6], lanes[7], lanes[8]) - p0;
+
+    auto p = cross(d, e2);
+    auto inv_det = vdouble(1.0) / dot(e1, p);
+
+    auto s = o - p0;
+    auto lane_u = dot(s, p) * inv_det;
+
+    auto q = cross(s, e1);
+    auto lane_v = dot(d, q) * inv_det;
+    auto lane_t = dot(e2, q) * inv_det;
+
+    const vdouble zero(0.0), one(1.0);
+    auto inside = (zero <= lane_u) & (zero <= lane_v) & (lane_u + lane_v <= one)
+                & (vdouble(t_min) < lane_t) & (lane_t < vdouble(t_max));
+
+    lane_t.store(t);
+    lane_u.store(u);
+    lane_v.store(v);
+    return static_cast<uint32_t>(inside.bits()) & ((1u << n) - 1);
+}
+
+
+bool triangle_mesh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    constexpr int W = vdouble::width;
+    uint32_t closest = 0;
+    double closest_u = 0, closest_v = 0;
+
+    bool hit_anything = tree.closest_hit(r, t_min, t_max,
+        [&](uint32_t first, uint32_t count, double& t_max) {
+            alignas(32) double t[W], u[W], v[W];
+            bool hit_leaf = false;
+            for (uint32_t batch = first; batch < first + count; batch += W) {
+                auto hits = intersect(r, batch, std::min<uint32_t>(W, first + count - batch),
+                                      t_min, t_max, t, u, v);
+                for (; hits != 0; hits &= hits - 1) {
+                    int i = lowest_lane(hits);
+                    if (t[i] < t_max) {
+                        t_max = t[i];
+                        closest = batch + i;
+                        closest_u = u[i];
+                        closest_v = v[i];
+                        hit_leaf = true;
+                    }
+                }
+            }
+            if (hit_leaf)
+                rec.t = t_max;
+            return hit_leaf;
+        });
+
+    if (!hit_anything)
+        return false;
+
+    auto p0 = vertex(indices[3*closest]);
+    auto outward_normal = unit_vector(cross(vertex(indices[3*closest+1]) - p0,
+                                            vertex(indices[3*closest+2]) - p0));
+    rec.p = r.at(rec.t);
+    rec.set_face_normal(r, outward_normal);
+    rec.u = closest_u;
+    rec.v = closest_v;
+    rec.mat_ptr = mp;
+    return true;
+}
+
+
+bool triangle_mesh::occluded(const ray& r, double t_min, double t_max) const {
+    constexpr int W = vdouble::width;
+    return tree.any_hit(r, t_min, t_max, [&](uint32_t first, uint32_t count) {
+        alignas(32) double t[W], u[W], v[W];
+        for (uint32_t batch = first; batch < first + count; batch += W)
+            if (intersect(r, batch, std::min<uint32_t>(W, first + count - batch), t_min, t_max, t, u, v))
+                return true;
+        return false;
+    });
+}
+
+#endif
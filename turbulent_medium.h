@@ -10,10 +10,9 @@
 
 class turbulent_medium : public hittable {
     public:
-        turbulent_medium(shared_ptr<hittable> b, double d, shared_ptr<texture> a)
-            : boundary(b), neg_inv_density(-1/d), phase_function(make_shared<cloud>(a)) {}
-        turbulent_medium(shared_ptr<hittable> b, double d, color c)
-            : boundary(b), neg_inv_density(-1/d), phase_function(make_shared<cloud>(c)) {}
+        // phase is normally a cloud material from the scene's material_table.
+        turbulent_medium(shared_ptr<hittable> b, double d, const material* phase)
+            : boundary(b), phase_function(phase), neg_inv_density(-1/d) {}
 
         virtual bool hit(
             const ray& r, double t_min, double t_max, hit_record& rec) const override;
@@ -23,7 +22,7 @@ class turbulent_medium : public hittable {
         }
     public:
         shared_ptr<hittable> boundary;
-        shared_ptr<material> phase_function;
+        const material* phase_function;
         double neg_inv_density;
         perlin noise;
 };
@@ -4,52 +4,73 @@
 #include <cmath>
 #include <iostream>
 
+#include "rng.h"
+
 using std::sqrt;
 
-class vec3 {
+// Precision of vectors, and with them of points, colors, rays and bounding boxes: double by
+// default, float when built with -DRTW_FLOAT (make tracer_float). Only vec3 follows real.
+// Scalars such as ray distances, the SIMD lanes (simd.h), ray packets and sphere data stay
+// double. BVH bounds and mesh vertices are float in both builds. The float build is
+// therefore a check of how much an image depends on vector precision, not a faster tracer.
+// Code that needs double for its vectors too, like sphere intersection at large
+// coordinates, converts to dvec3 first.
+#if defined(RTW_FLOAT)
+using real = float;
+#else
+using real = double;
+#endif
+
+// One vector per object, three components wide. Kernels that run the same math on many
+// vectors at once use vvec3 (simd.h), which keeps one component of several per register.
+template <typename T>
+class basic_vec3 {
     public:
-        vec3() : e{0,0,0} {}
-        vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+        basic_vec3() : e{0,0,0} {}
+        basic_vec3(T e0, T e1, T e2) : e{e0, e1, e2} {}
 
-        double x() const { return e[0]; }
-        double y() const { return e[1]; }
-        double z() const { return e[2]; }
+        template <typename U>
+        explicit basic_vec3(const basic_vec3<U>& v) : e{T(v.e[0]), T(v.e[1]), T(v.e[2])} {}
 
-        vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-        double operator[](int i) const { return e[i]; }
-        double& operator[](int i) { return e[i]; }
+        T x() const { return e[0]; }
+        T y() const { return e[1]; }
+        T z() const { return e[2]; }
 
-        vec3& operator+=(const vec3 &v) {
+        basic_vec3 operator-() const { return basic_vec3(-e[0], -e[1], -e[2]); }
+        T operator[](int i) const { return e[i]; }
+        T& operator[](int i) { return e[i]; }
+
+        basic_vec3& operator+=(const basic_vec3 &v) {
             e[0] += v.e[0];
             e[1] += v.e[1];
             e[2] += v.e[2];
             return *this;
         }
 
-        vec3& operator*=(const double t) {
+        basic_vec3& operator*=(const T t) {
             e[0] *= t;
             e[1] *= t;
             e[2] *= t;
             return *this;
         }
 
-        vec3& operator/=(const double t) {
+        basic_vec3& operator/=(const T t) {
             return *this *= 1/t;
         }
 
-        inline static vec3 random() {
-            return vec3(random_double(), random_double(), random_double());
+        inline static basic_vec3 random() {
+            return basic_vec3(random_double(), random_double(), random_double());
         }
 
-        inline static vec3 random(double min, double max) {
-            return vec3(random_double(min, max), random_double(min, max), random_double(min, max)); 
+        inline static basic_vec3 random(double min, double max) {
+            return basic_vec3(random_double(min, max), random_double(min, max), random_double(min, max));
         }
 
-        double length() const {
+        T length() const {
             return sqrt(length_squared());
         }
 
-        double length_squared() const {
+        T length_squared() const {
             return e[0]*e[0] + e[1]*e[1] + e[2]*e[2];
         }
 
@@ -58,60 +79,63 @@ class vec3 {
             return (fabs(e[0]) < s) && (fabs(e[1]) < s && fabs(e[2]) < s);
         }
 
-    public:
-        double e[3];
-};
+        // The arithmetic is defined here rather than as templates so a double scale factor
+        // converts to T instead of failing to deduce.
+        friend std::ostream& operator<<(std::ostream &out, const basic_vec3 &v) {
+            return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
+        }
 
-// Type aliases for vec3
-using point3 = vec3;   // 3D point
-using color = vec3;    // RGB color
+        friend basic_vec3 operator+(const basic_vec3 &u, const basic_vec3 &v) {
+            return basic_vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+        }
 
+        friend basic_vec3 operator-(const basic_vec3 &u, const basic_vec3 &v) {
+            return basic_vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+        }
 
-// vec3 Utility Functions
+        friend basic_vec3 operator*(const basic_vec3 &u, const basic_vec3 &v) {
+            return basic_vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+        }
 
-inline std::ostream& operator<<(std::ostream &out, const vec3 &v) {
-    return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
-}
+        friend basic_vec3 operator*(T t, const basic_vec3 &v) {
+            return basic_vec3(t*v.e[0], t*v.e[1], t*v.e[2]);
+        }
 
-inline vec3 operator+(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
-}
+        friend basic_vec3 operator*(const basic_vec3 &v, T t) {
+            return t * v;
+        }
 
-inline vec3 operator-(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
-}
+        friend basic_vec3 operator/(basic_vec3 v, T t) {
+            return (1/t) * v;
+        }
 
-inline vec3 operator*(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
-}
+        friend T dot(const basic_vec3 &u, const basic_vec3 &v) {
+            return u.e[0] * v.e[0]
+                 + u.e[1] * v.e[1]
+                 + u.e[2] * v.e[2];
+        }
 
-inline vec3 operator*(double t, const vec3 &v) {
-    return vec3(t*v.e[0], t*v.e[1], t*v.e[2]);
-}
+        friend basic_vec3 cross(const basic_vec3 &u, const basic_vec3 &v) {
+            return basic_vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
+                              u.e[2] * v.e[0] - u.e[0] * v.e[2],
+                              u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+        }
 
-inline vec3 operator*(const vec3 &v, double t) {
-    return t * v;
-}
+        friend basic_vec3 unit_vector(basic_vec3 v) {
+            return v / v.length();
+        }
 
-inline vec3 operator/(vec3 v, double t) {
-    return (1/t) * v;
-}
+    public:
+        T e[3];
+};
 
-inline double dot(const vec3 &u, const vec3 &v) {
-    return u.e[0] * v.e[0]
-         + u.e[1] * v.e[1]
-         + u.e[2] * v.e[2];
-}
+using vec3 = basic_vec3<real>;
+using dvec3 = basic_vec3<double>;
 
-inline vec3 cross(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
-                u.e[2] * v.e[0] - u.e[0] * v.e[2],
-                u.e[0] * v.e[1] - u.e[1] * v.e[0]);
-}
+// Type aliases for vec3
+using point3 = vec3;   // 3D point
+using color = vec3;    // RGB color
 
-inline vec3 unit_vector(vec3 v) {
-    return v / v.length();
-}
 
 vec3 random_in_unit_sphere() {
     while(true) {
@@ -121,10 +145,22 @@ vec3 random_in_unit_sphere() {
     }
 }
 
+vec3 random_in_unit_sphere(sampler& rng) {
+    while(true) {
+        auto p = vec3(rng.random_double(-1, 1), rng.random_double(-1, 1), rng.random_double(-1, 1));
+        if (p.length_squared() >= 1) continue;
+        return p;
+    }
+}
+
 vec3 random_unit_vector() {
     return unit_vector(random_in_unit_sphere());
 }
 
+vec3 random_unit_vector(sampler& rng) {
+    return unit_vector(random_in_unit_sphere(rng));
+}
+
 vec3 reflect(const vec3& v, const vec3& n) {
     return v - 2*dot(v, n)*n;
 }
@@ -144,5 +180,13 @@ vec3 random_in_unit_disk() {
     }
 }
 
+vec3 random_in_unit_disk(sampler& rng) {
+    while (true) {
+        auto p = vec3(rng.random_double(-1, 1), rng.random_double(-1, 1), 0);
+        if (p.length_squared() >= 1) continue;
+        return p;
+    }
+}
+
 #endif
 
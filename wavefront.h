@@ -0,0 +1,365 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "rtweekend.h"
+
+#include "adaptive.h"
+#include "alloc_counter.h"
+#include "camera.h"
+#include "direct_light.h"
+#include "hittable.h"
+#include "material.h"
+#include "ray_packet.h"
+#include "roulette.h"
+#include "scene.h"
+#include "tile_scheduler.h"
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+// Wavefront path tracer. Instead of following one path through every bounce the way
+// ray_color() does, it keeps a whole wave of paths in structure-of-arrays storage and runs
+// each stage over all of them before moving on to the next:
+//
+//     generate     camera rays for the next (pixel, sample) pairs of the tile
+//     intersect    every queued ray against the world; misses pick up the background
+//     shade        emission and material scattering at every hit
+//     sample       a light sample and the continuing ray for hits that importance sample
+//     shadow       the light samples' shadow rays, as any-hit occlusion queries
+//     accumulate   finished paths into their pixel estimators, in sample order
+//
+// Stages hand paths to each other through index queues, so a stage only touches the paths
+// that need it and the queues stay dense as paths terminate. Each path carries its own
+// sampler and draws random numbers in the same order ray_color() does, so both integrators
+// produce the same samples up to floating point rounding.
+class wavefront_integrator {
+    public:
+        wavefront_integrator(const scene& s, const camera& c, int image_width, int image_height,
+                             uint64_t seed, int max_depth, int roulette_depth,
+                             int wave_size = 1 << 14, int packet_size = 16)
+            : scn(s), cam(c), width(image_width), height(image_height), seed(seed),
+              max_depth(max_depth), roulette_depth(roulette_depth), wave_size(std::max(wave_size, 1)),
+              packet_size(std::min(std::max(packet_size, 1), ray_packet::max_size))
+        {}
+
+        // Takes samples for every pixel of t until samples_wanted() is satisfied. estimates
+        // holds one estimator per pixel, rows from the top of the tile down and left to
+        // right within a row, and is continued from whatever samples it already has.
+        void render_tile(const tile& t, std::vector<pixel_estimator>& estimates,
+                         const adaptive_settings& adaptive, int samples_per_pixel) {
+            int tile_width = t.x1 - t.x0;
+            int pixels = static_cast<int>(estimates.size());
+            batch.resize(pixels);
+            first_sample.resize(pixels);
+            reserve_wave();
+
+            // With the buffers sized, tracing the tile must not touch the heap.
+            auto allocations = allocation_count();
+
+            // Each round asks every pixel for its next batch, exactly as the scalar loop
+            // does after each batch, and traces the requested samples in waves.
+            for (;;) {
+                long long requested = 0;
+                for (int k = 0; k < pixels; k++) {
+                    batch[k] = std::max(samples_wanted(estimates[k], adaptive, samples_per_pixel), 0);
+                    first_sample[k] = estimates[k].count();
+                    requested += batch[k];
+                }
+                if (requested == 0) break;
+
+                int k = 0, s = 0;
+                while (k < pixels) {
+                    int n = 0;
+
+                    // Generate: camera rays for the next pending (pixel, sample) pairs.
+                    for (; k < pixels && n < wave_size; s = 0, k++) {
+                        int i = t.x0 + k % tile_width;
+                        int j = t.y1 - 1 - k / tile_width;
+                        for (; s < batch[k] && n < wave_size; s++, n++)
+                            generate(n, k, i, j, first_sample[k] + s);
+                        if (s < batch[k]) break;
+                    }
+
+                    trace(n);
+
+                    // Accumulate: paths were generated pixel by pixel in sample order, so
+                    // adding them in path order keeps each estimator's sequence intact.
+                    for (int p = 0; p < n; p++)
+                        estimates[paths.pixel[p]].add(paths.radiance(p));
+                }
+            }
+            assert(allocation_count() == allocations && "wavefront render loop allocated");
+        }
+
+    private:
+        // One entry per path in the wave; index p addresses the same path in every array.
+        struct path_states {
+            std::vector<double> ox, oy, oz;
+            std::vector<double> dx, dy, dz;
+            std::vector<double> time;
+            std::vector<double> tr, tg, tb;     // throughput
+            std::vector<double> lr, lg, lb;     // radiance gathered so far
+            std::vector<double> ar, ag, ab;     // albedo handed from shade to sample
+            std::vector<double> nx, ny, nz;     // scattered direction handed from shade to sample
+            std::vector<double> bsdf_pdf;       // see weighted_emission()
+            std::vector<uint32_t> medium_dimension;     // see ray::sample_media()
+            std::vector<int> depth;             // bounces left
+            std::vector<int> pixel;             // index into the tile's estimators
+            std::vector<sampler> rng;
+            std::vector<hit_record> rec;
+            std::vector<light_sample> light;    // handed from sample to shadow
+
+            void resize(int n) {
+                for (auto v : {&ox, &oy, &oz, &dx, &dy, &dz, &time, &tr, &tg, &tb,
+                               &lr, &lg, &lb, &ar, &ag, &ab, &nx, &ny, &nz, &bsdf_pdf})
+                    v->resize(n);
+                depth.resize(n);
+                medium_dimension.resize(n);
+                pixel.resize(n);
+                rng.resize(n, sampler(0, 0, 0));
+                rec.resize(n);
+                light.resize(n);
+            }
+
+            ray get_ray(int p) const {
+                ray r(point3(ox[p], oy[p], oz[p]), vec3(dx[p], dy[p], dz[p]), time[p]);
+                r.medium_rng = &rng[p];
+                r.medium_dimension = medium_dimension[p];
+                return r;
+            }
+
+            void set_ray(int p, const ray& r) {
+                ox[p] = r.orig.x(); oy[p] = r.orig.y(); oz[p] = r.orig.z();
+                dx[p] = r.dir.x();  dy[p] = r.dir.y();  dz[p] = r.dir.z();
+                time[p] = r.tm;
+            }
+
+            color radiance(int p) const { return color(lr[p], lg[p], lb[p]); }
+            color throughput(int p) const { return color(tr[p], tg[p], tb[p]); }
+
+            void scale_throughput(int p, const color& c) {
+                tr[p] *= c.x(); tg[p] *= c.y(); tb[p] *= c.z();
+            }
+
+            void add_radiance(int p, const color& c) {
+                lr[p] += tr[p] * c.x(); lg[p] += tg[p] * c.y(); lb[p] += tb[p] * c.z();
+            }
+
+            // c already includes the path's throughput.
+            void add_weighted_radiance(int p, const color& c) {
+                lr[p] += c.x(); lg[p] += c.y(); lb[p] += c.z();
+            }
+        };
+
+        const scene& scn;
+        const camera& cam;
+        int width, height;
+        uint64_t seed;
+        int max_depth;
+        int roulette_depth;
+        int wave_size;
+
+        path_states paths;
+        std::vector<int> batch, first_sample;   // per pixel, for the current round
+        std::vector<uint32_t> ray_queue, next_ray_queue, shade_queue, sample_queue, shadow_queue,
+                              first_shadow_queue;
+
+        int packet_size;
+        ray_packet packet;
+        uint32_t packet_paths[ray_packet::max_size];    // path index of each packet lane
+
+        void reserve_wave() {
+            if (static_cast<int>(paths.pixel.size()) == wave_size) return;
+            paths.resize(wave_size);
+            for (auto q : {&ray_queue, &next_ray_queue, &shade_queue, &sample_queue, &shadow_queue, &first_shadow_queue})
+                q->reserve(wave_size);
+        }
+
+        void generate(int p, int k, int i, int j, int sample) {
+            auto& rng = paths.rng[p];
+            rng = sampler(seed, i, j);
+            rng.start_sample(sample);
+
+            auto u = (i + rng.random_double()) / (width-1);
+            auto v = (j + rng.random_double()) / (height-1);
+            paths.set_ray(p, cam.get_ray(u, v, rng));
+
+            paths.tr[p] = paths.tg[p] = paths.tb[p] = 1.0;
+            paths.lr[p] = paths.lg[p] = paths.lb[p] = 0.0;
+            paths.bsdf_pdf[p] = 0;
+            paths.depth[p] = max_depth;
+            paths.pixel[p] = k;
+        }
+
+        // Runs the bounce stages until every path in the wave has terminated.
+        void trace(int n) {
+            ray_queue.clear();
+            for (int p = 0; p < n; p++)
+                ray_queue.push_back(p);
+
+            while (!ray_queue.empty()) {
+                intersect();
+                shade();
+                sample_lights();
+                trace_shadows();
+                std::swap(ray_queue, next_ray_queue);
+            }
+        }
+
+        // Camera rays are generated pixel by pixel, so neighbouring paths on their first
+        // bounce are coherent and traced as packets. Later bounces scatter in every
+        // direction and go through the scalar traversal.
+        void intersect() {
+            shade_queue.clear();
+            packet.clear();
+            for (auto p : ray_queue) {
+                if (paths.depth[p] <= 0)
+                    continue;
+                paths.medium_dimension[p] = paths.rng[p].reserve_dimension();
+
+                if (packet_size > 1 && paths.depth[p] == max_depth) {
+                    packet_paths[packet.add(paths.get_ray(p))] = p;
+                    if (packet.size == packet_size)
+                        intersect_packet();
+                    continue;
+                }
+
+                if (scn.world.hit(paths.get_ray(p), 0.001, infinity, paths.rec[p]))
+                    shade_queue.push_back(p);
+                else
+                    paths.add_radiance(p, scn.background);
+            }
+            if (packet.size > 0)
+                intersect_packet();
+        }
+
+        void intersect_packet() {
+            double t_max[ray_packet::max_size];
+            hit_record* rec[ray_packet::max_size];
+            for (int l = 0; l < ray_packet::max_size; l++) {
+                t_max[l] = infinity;
+                rec[l] = l < packet.size ? &paths.rec[packet_paths[l]] : nullptr;
+            }
+
+            auto hits = scn.world.hit_packet(packet, packet.all_lanes(), 0.001, t_max, rec);
+            for (int l = 0; l < packet.size; l++) {
+                auto p = packet_paths[l];
+                if (hits & (1u << l))
+                    shade_queue.push_back(p);
+                else
+                    paths.add_radiance(p, scn.background);
+            }
+            packet.clear();
+        }
+
+        void shade() {
+            next_ray_queue.clear();
+            sample_queue.clear();
+            for (auto p : shade_queue) {
+                const auto& rec = paths.rec[p];
+                auto r_in = paths.get_ray(p);
+
+                paths.add_radiance(p, weighted_emission(scn.lights.get(), r_in, rec, paths.bsdf_pdf[p]));
+                paths.bsdf_pdf[p] = 0;
+
+                ray scattered;
+                color albedo;
+                double pdf_val;
+                if (!rec.mat_ptr->scatter(r_in, rec, albedo, scattered, pdf_val, paths.rng[p]))
+                    continue;
+
+                if (!rec.mat_ptr->skip_pdf() && scn.lights) {
+                    // The light sample comes first, so the path continues in the next stage.
+                    paths.ar[p] = albedo.x(); paths.ag[p] = albedo.y(); paths.ab[p] = albedo.z();
+                    paths.nx[p] = scattered.dir.x(); paths.ny[p] = scattered.dir.y(); paths.nz[p] = scattered.dir.z();
+                    paths.bsdf_pdf[p] = pdf_val;
+                    sample_queue.push_back(p);
+                    continue;
+                }
+
+                if (!rec.mat_ptr->skip_pdf())
+                    albedo = albedo * rec.mat_ptr->scattering_pdf(r_in, rec, scattered) / pdf_val;
+                continue_path(p, albedo, scattered);
+            }
+        }
+
+        // Takes a light sample from every hit in the sample queue, the way ray_color() does,
+        // then continues the path along the direction shade() scattered it in.
+        void sample_lights() {
+            shadow_queue.clear();
+            first_shadow_queue.clear();
+            for (auto p : sample_queue) {
+                const auto& rec = paths.rec[p];
+                auto r_in = paths.get_ray(p);
+                color albedo(paths.ar[p], paths.ag[p], paths.ab[p]);
+
+                auto& sample = paths.light[p];
+                if (sample_light(*scn.lights, r_in, rec, albedo, paths.rng[p], sample)) {
+                    sample.radiance = paths.throughput(p) * sample.radiance;
+                    if (packet_size > 1 && paths.depth[p] == max_depth)
+                        first_shadow_queue.push_back(p);
+                    else
+                        shadow_queue.push_back(p);
+                }
+
+                ray scattered(rec.p, vec3(paths.nx[p], paths.ny[p], paths.nz[p]), r_in.time());
+                auto weight = albedo * rec.mat_ptr->scattering_pdf(r_in, rec, scattered) / paths.bsdf_pdf[p];
+                continue_path(p, weight, scattered);
+            }
+        }
+
+        // Shadow rays only need to know whether anything is in the way, so they go through
+        // occluded() and never fill in a hit_record. Those from first-bounce hits leave from
+        // neighbouring points for the same lights and are traced as packets, like the camera
+        // rays; later ones go through the scalar traversal.
+        void trace_shadows() {
+            for (auto p : shadow_queue) {
+                const auto& sample = paths.light[p];
+                if (!scn.world.occluded(sample.shadow, 0.001, sample.t_max))
+                    paths.add_weighted_radiance(p, sample.radiance);
+            }
+
+            packet.clear();
+            for (auto p : first_shadow_queue) {
+                packet_paths[packet.add(paths.light[p].shadow)] = p;
+                if (packet.size == packet_size)
+                    trace_shadow_packet();
+            }
+            if (packet.size > 0)
+                trace_shadow_packet();
+        }
+
+        void trace_shadow_packet() {
+            double t_max[ray_packet::max_size];
+            for (int l = 0; l < ray_packet::max_size; l++)
+                t_max[l] = l < packet.size ? paths.light[packet_paths[l]].t_max : 0.0;
+
+            auto blocked = scn.world.occluded_packet(packet, packet.all_lanes(), 0.001, t_max);
+            for (int l = 0; l < packet.size; l++) {
+                auto p = packet_paths[l];
+                if (!(blocked & (1u << l)))
+                    paths.add_weighted_radiance(p, paths.light[p].radiance);
+            }
+            packet.clear();
+        }
+
+        // Queues the path's next ray with its throughput scaled by weight, unless Russian
+        // roulette ends it here.
+        void continue_path(int p, color weight, const ray& scattered) {
+            auto survival = survival_probability(color(paths.tr[p], paths.tg[p], paths.tb[p]) * weight,
+                                                 paths.depth[p], roulette_depth);
+            if (survival < 1.0) {
+                if (paths.rng[p].random_double() >= survival)
+                    return;
+                weight /= survival;
+            }
+
+            paths.scale_throughput(p, weight);
+            paths.set_ray(p, scattered);
+            paths.depth[p]--;
+            next_ray_queue.push_back(p);
+        }
+};
+
+#endif